@@ -16,8 +16,11 @@
  *
  */
 
+#include <cstring>
+
 #include "NibeGw.h"
 #include "esphome/core/gpio.h"
+#include "esphome/core/hal.h"
 #include "esphome/components/uart/uart.h"
 
 using namespace esphome;
@@ -25,6 +28,21 @@ using namespace esphome;
 NibeGw::NibeGw(esphome::uart::UARTDevice *serial, esphome::GPIOPin *RS485DirectionPin) {
   state = STATE_WAIT_START;
   connectionState = false;
+  index = 0;
+  frameStartTime = 0;
+  frameCompleteTime = 0;
+  frameOutcome = FRAME_OUTCOME_NONE;
+  responseSent = false;
+  startCandidateTime = 0;
+  lastByteTime = 0;
+  interByteTimeout = 0;
+  lastLoopTime = 0;
+  loopGapMax = 0;
+  cycleGap = 0;
+  cycleCount = 0;
+  busId = 0;
+  memset(addressAcknowledge, 0, sizeof(addressAcknowledge));
+  payloadValid = false;
   RS485 = serial;
   directionPin = RS485DirectionPin;
   setCallback(NULL, NULL);
@@ -82,6 +100,8 @@ void NibeGw::handleDataReceived(uint8_t b) {
 
       buffer[0] = buffer[1];
       buffer[1] = b;
+      frameStartTime = startCandidateTime;
+      startCandidateTime = lastByteTime;
 
       if (buffer[0] == STARTBYTE_MASTER) {
         if (buffer[1] == STARTBYTE_MASTER) {
@@ -90,6 +110,8 @@ void NibeGw::handleDataReceived(uint8_t b) {
         } else {
           index = 2;
           state = STATE_WAIT_DATA;
+          master.begin(STARTBYTE_MASTER, payload);
+          master.push(buffer[1]);
           ESP_LOGVV(TAG, "Frame start found");
         }
       } else {
@@ -104,6 +126,7 @@ void NibeGw::handleDataReceived(uint8_t b) {
         indexSlave = index;
         buffer[index++] = b;
         state = STATE_WAIT_DATA_SLAVE;
+        slave.begin(STARTBYTE_SLAVE, nullptr);
       } else {
         handleExpectedAck(b);
       }
@@ -116,7 +139,7 @@ void NibeGw::handleDataReceived(uint8_t b) {
     case STATE_WAIT_DATA_SLAVE: {
       buffer[index++] = b;
 
-      eParse check = checkSlaveData(&buffer[indexSlave], index - indexSlave);
+      eParse check = slave.push(b);
       if (check == PACKET_PENDING) {
         break;
       }
@@ -134,16 +157,19 @@ void NibeGw::handleDataReceived(uint8_t b) {
     case STATE_WAIT_DATA:
       buffer[index++] = b;
 
-      eParse check = checkMasterData(buffer, index);
+      eParse check = master.push(b);
       if (check == PACKET_PENDING) {
         break;
       }
 
       if (check == PACKET_OK) {
+        payloadValid = true;
+        tagBus(true);
         handleMsgReceived();
         break;
       }
 
+      tagBus(false);
       handleCrcFailure();
       break;
   }
@@ -153,7 +179,10 @@ void NibeGw::handleExpectedAck(uint8_t b) {
   buffer[index++] = b;
   ESP_LOGV(TAG, "Recv: %02X", b);
   if (b == STARTBYTE_ACK || b == STARTBYTE_NACK) {
-    /* Complete */
+    /* Complete, for a token we answered this is the pump's verdict on our response */
+    if (responseSent) {
+      frameOutcome = b == STARTBYTE_ACK ? FRAME_OUTCOME_ACK : FRAME_OUTCOME_NAK;
+    }
   } else if (b == STARTBYTE_MASTER) {
     /* Next message */
     index--;
@@ -173,10 +202,18 @@ void NibeGw::stateComplete(uint8_t data) {
 #endif
   }
 
+  frameCompleteTime = micros();
   callback_msg_received(buffer, index);
+  payloadValid = false;
+  frameOutcome = FRAME_OUTCOME_NONE;
+  responseSent = false;
   state = STATE_WAIT_START;
   index = 0;
   buffer[1] = data;  // reset second byte
+  if (data == STARTBYTE_MASTER) {
+    /* the start byte of the next frame was consumed here, not in STATE_WAIT_START */
+    startCandidateTime = lastByteTime;
+  }
 }
 
 void NibeGw::handleMsgReceived() {
@@ -184,11 +221,13 @@ void NibeGw::handleMsgReceived() {
   const uint8_t command = buffer[3];
   const uint8_t len = buffer[4];
   if (shouldAckNakSend(address)) {
+    completeCycle();
     if (len == 0) {
       int msglen = callback_msg_token_received(address, command, &buffer[index]);
       if (msglen > 0) {
         sendData(&buffer[index], msglen);
         index += msglen;
+        responseSent = true;
         state = STATE_WAIT_ACK;
       } else {
         stateCompleteAck();
@@ -204,6 +243,7 @@ void NibeGw::handleMsgReceived() {
 void NibeGw::handleCrcFailure() {
   ESP_LOGW(TAG, "Had crc failure");
   if (shouldAckNakSend(buffer[2] | (buffer[1] << 8))) {
+    completeCycle();
     stateCompleteNak();
   } else {
     stateComplete(0);
@@ -215,29 +255,61 @@ void NibeGw::handleInvalidData(uint8_t data) {
   stateComplete(data);
 }
 
-void NibeGw::loop() {
-  if (!connectionState)
+void NibeGw::handleTimeout() {
+  ESP_LOGW(TAG, "Inter-byte timeout after %u bytes, resyncing", (unsigned) index);
+  if (state == STATE_WAIT_DATA_SLAVE) {
+    /* master part is complete, forward it like any other failed slave response */
+    stateComplete(0);
+  } else {
+    state = STATE_WAIT_START;
+    index = 0;
+    buffer[1] = 0;
+  }
+}
+
+void NibeGw::tagBus(bool valid) {
+  if (!busId)
     return;
 
-  if (RS485->available() > 0) {
-    uint8_t b = RS485->read();
-    ESP_LOGVV(TAG, "%02X", b);
-    handleDataReceived(b);
+  /* the running checksum covers the original second byte, swap it for the id */
+  const uint8_t checksum = master.checksum ^ buffer[1] ^ busId;
+  buffer[1] = busId;
+  if (valid) {
+    buffer[index - 1] = checksum == STARTBYTE_MASTER ? 0xC5 : checksum;
+  } else {
+    /* keep a broken frame broken */
+    buffer[index - 1] ^= busId;
   }
 }
 
-uint8_t NibeGw::calculateChecksum(const uint8_t *const data, uint8_t len) {
-  uint8_t checksum = 0;
-  for (uint8_t i = 0; i < len; i++) {
-    checksum ^= data[i];
+void NibeGw::completeCycle() {
+  cycleGap = loopGapMax;
+  loopGapMax = 0;
+  cycleCount++;
+}
+
+void NibeGw::loop() {
+  if (!connectionState)
+    return;
+
+  uint32_t now = micros();
+  bool pending = RS485->available() > 0;
+  if ((pending || state != STATE_WAIT_START) && now - lastLoopTime > loopGapMax) {
+    loopGapMax = now - lastLoopTime;
   }
+  lastLoopTime = now;
 
-  if (checksum == STARTBYTE_MASTER) {
-    // if checksum is 0x5C (start character),
-    // heat pump seems to send 0xC5 checksum
-    checksum = 0xC5;
+  if (pending) {
+    uint8_t b = RS485->read();
+    lastByteTime = now;
+    ESP_LOGVV(TAG, "%02X", b);
+    handleDataReceived(b);
+  } else if (interByteTimeout && (state == STATE_WAIT_DATA || state == STATE_WAIT_DATA_SLAVE)) {
+    /* only checked with an empty uart, bytes still buffered are not a gap on the line */
+    if (now - lastByteTime > interByteTimeout) {
+      handleTimeout();
+    }
   }
-  return checksum;
 }
 
 void NibeGw::sendBegin() {
@@ -275,6 +347,7 @@ void NibeGw::stateCompleteAck() {
   ESP_LOGV(TAG, "Sent: %02X", STARTBYTE_ACK);
 
   buffer[index++] = STARTBYTE_ACK;
+  frameOutcome = FRAME_OUTCOME_ACK;
   stateComplete(0);
 }
 
@@ -285,64 +358,105 @@ void NibeGw::stateCompleteNak() {
   ESP_LOGV(TAG, "Sent: %02X", STARTBYTE_NACK);
 
   buffer[index++] = STARTBYTE_NACK;
+  frameOutcome = FRAME_OUTCOME_NAK;
   stateComplete(0);
 }
 
 bool NibeGw::shouldAckNakSend(uint16_t address) {
-  return addressAcknowledge.count(address) != 0;
+  if ((address >> 8) != busId)
+    return false;
+  return addressAcknowledge[(address & 0xff) >> 3] & (1 << (address & 7));
 }
 
-eParse NibeGw::checkSlaveData(const uint8_t *data, size_t len) {
-  /* start, cmd, len, data[len], checksum */
-  if (len < 4) {
+void FrameParser::begin(uint8_t start, uint8_t *out) {
+  /* the master checksum starts after the start byte, the slave one includes it */
+  header = start == STARTBYTE_MASTER ? 4 : 2;
+  count = 0;
+  len = 0;
+  checksum = start == STARTBYTE_MASTER ? 0 : start;
+  payload = out;
+  payloadLen = 0;
+  escape = false;
+}
+
+eParse FrameParser::push(uint8_t b) {
+  count++;
+  if (count <= header) {
+    /* the last header byte is the length, earlier ones are just overwritten */
+    checksum ^= b;
+    len = b;
     return PACKET_PENDING;
   }
 
-  if (data[0] != STARTBYTE_SLAVE) {
-    ESP_LOGD(TAG, "Slave start byte is invalid");
-    return PACKET_ERR;
+  if (count <= header + len) {
+    checksum ^= b;
+    if (payload) {
+      if (b == STARTBYTE_MASTER && escape) {
+        escape = false;
+      } else {
+        escape = b == STARTBYTE_MASTER;
+        payload[payloadLen++] = b;
+      }
+    }
+    return PACKET_PENDING;
   }
 
-  if (len - 4 < data[2]) {
+  // if checksum is 0x5C (start character),
+  // heat pump seems to send 0xC5 checksum
+  const uint8_t expected = checksum == STARTBYTE_MASTER ? 0xC5 : checksum;
+  return b == expected ? PACKET_OK : PACKET_ERR;
+}
+
+static eParse checkData(FrameParser &parser, const uint8_t *data, size_t len) {
+  for (size_t i = 1; i < len; i++) {
+    eParse check = parser.push(data[i]);
+    if (check == PACKET_PENDING) {
+      continue;
+    }
+    if (i != len - 1) {
+      return PACKET_ERR;
+    }
+    return check;
+  }
+  return PACKET_PENDING;
+}
+
+eParse NibeGw::checkSlaveData(const uint8_t *data, size_t len) {
+  /* start, cmd, len, data[len], checksum */
+  if (len < 1) {
     return PACKET_PENDING;
   }
 
-  if (len - 4 != data[2]) {
-    ESP_LOGD(TAG, "Slave packet has invalid size");
+  if (data[0] != STARTBYTE_SLAVE) {
+    ESP_LOGD(TAG, "Slave start byte is invalid");
     return PACKET_ERR;
   }
 
-  const uint8_t checksum = calculateChecksum(data, len - 1);
-  if (data[len - 1] != checksum) {
-    ESP_LOGD(TAG, "Slave data checksum is invalid");
-    return PACKET_ERR;
+  FrameParser parser;
+  parser.begin(STARTBYTE_SLAVE, nullptr);
+  eParse check = checkData(parser, data, len);
+  if (check == PACKET_ERR) {
+    ESP_LOGD(TAG, "Slave packet has invalid size or checksum");
   }
-  return PACKET_OK;
+  return check;
 }
 
 eParse NibeGw::checkMasterData(const uint8_t *data, size_t len) {
   /* start, address1, address2, cmd, len, data[len], checksum */
-  if (len < 6) {
+  if (len < 1) {
     return PACKET_PENDING;
   }
+
   if (data[0] != STARTBYTE_MASTER) {
     ESP_LOGD(TAG, "Master start byte is invalid");
     return PACKET_ERR;
   }
 
-  if (len - 6 < data[4]) {
-    return PACKET_PENDING;
-  }
-
-  if (len - 6 != data[4]) {
-    ESP_LOGD(TAG, "Master packet too large");
-    return PACKET_ERR;
-  }
-
-  const uint8_t checksum = calculateChecksum(&data[1], len - 2);
-  if (data[len - 1] != checksum) {
-    ESP_LOGD(TAG, "Master data checksum is invalid");
-    return PACKET_ERR;
+  FrameParser parser;
+  parser.begin(STARTBYTE_MASTER, nullptr);
+  eParse check = checkData(parser, data, len);
+  if (check == PACKET_ERR) {
+    ESP_LOGD(TAG, "Master packet has invalid size or checksum");
   }
-  return PACKET_OK;
-}
\ No newline at end of file
+  return check;
+}
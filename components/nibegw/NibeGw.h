@@ -40,7 +40,6 @@
 #include "esphome/components/uart/uart.h"
 #include "esphome/core/gpio.h"
 #include <functional>
-#include <set>
 
 using namespace esphome;
 
@@ -62,6 +61,12 @@ enum eTokenType {
   ACCESSORY_TOKEN = 0xEE,
 };
 
+enum eMessageType {
+  MODBUS_DATA_MSG = 0x68,
+  READ_RESP = 0x6A,
+  WRITE_RESP = 0x6C,
+};
+
 enum eStartByte {
   STARTBYTE_MASTER = 0x5c,
   STARTBYTE_SLAVE = 0xc0,
@@ -75,6 +80,13 @@ enum eParse {
   PACKET_OK,
 };
 
+// how the gateway itself answered a frame
+enum eFrameOutcome {
+  FRAME_OUTCOME_NONE,
+  FRAME_OUTCOME_ACK,
+  FRAME_OUTCOME_NAK,
+};
+
 // message buffer for RS-485 communication. Max message length is 80 bytes + 6 bytes header
 #define MAX_DATA_LEN 128
 
@@ -92,6 +104,22 @@ typedef std::function<int(uint16_t address, uint8_t command, uint8_t *data)> cal
 #define DEH500 0x27
 #define EME20 0xA4
 
+// Incremental frame parser, fed one byte at a time as it arrives. It keeps
+// the running checksum and length state, and optionally the payload with the
+// doubled 0x5C of the line removed, so a complete frame is never rescanned.
+struct FrameParser {
+  size_t header;      /* bytes after the start byte, up to and including LEN */
+  size_t count;       /* bytes pushed after the start byte */
+  uint8_t len;        /* payload length on the line */
+  uint8_t checksum;   /* running xor, before 0x5C is mapped to 0xC5 */
+  uint8_t *payload;   /* de-escaped payload output, may be null */
+  uint8_t payloadLen; /* de-escaped payload bytes written so far */
+  bool escape;        /* last payload byte was a 0x5C that may be doubled */
+
+  void begin(uint8_t start, uint8_t *out);
+  eParse push(uint8_t b);
+};
+
 class NibeGw {
  private:
   eState state;
@@ -100,17 +128,35 @@ class NibeGw {
   uint8_t buffer[MAX_DATA_LEN * 2];
   size_t index;
   size_t indexSlave;
+  uint32_t frameStartTime;
+  uint32_t frameCompleteTime;
+  eFrameOutcome frameOutcome;
+  bool responseSent;
+  uint32_t startCandidateTime;
+  uint32_t lastByteTime;
+  uint32_t interByteTimeout;
+  uint32_t lastLoopTime;
+  uint32_t loopGapMax;
+  uint32_t cycleGap;
+  uint32_t cycleCount;
+  uint8_t busId;
   esphome::uart::UARTDevice *RS485;
   callback_msg_received_type callback_msg_received;
   callback_msg_token_received_type callback_msg_token_received;
-  std::set<uint16_t> addressAcknowledge;
+  uint8_t addressAcknowledge[32]; /* bit per address on this bus */
+  FrameParser master;
+  FrameParser slave;
+  uint8_t payload[MAX_DATA_LEN];
+  bool payloadValid;
 
-  uint8_t calculateChecksum(const uint8_t *data, uint8_t len);
   void sendData(const uint8_t *data, uint8_t len);
   void sendBegin();
   void sendEnd();
   bool shouldAckNakSend(uint16_t address);
   void handleInvalidData(uint8_t data);
+  void handleTimeout();
+  void tagBus(bool valid);
+  void completeCycle();
   void handleCrcFailure();
   void handleMsgReceived();
   void handleDataReceived(uint8_t b);
@@ -138,11 +184,70 @@ class NibeGw {
   eParse checkSlaveData(const uint8_t *data, size_t len);
   eParse checkMasterData(const uint8_t *data, size_t len);
 
-  void setAcknowledge(uint8_t address, bool val) {
+  // De-escaped payload of the frame passed to the received callback, null
+  // unless it is a master frame with a valid checksum.
+  const uint8_t *getPayload() {
+    return payloadValid ? payload : nullptr;
+  }
+  size_t getPayloadLength() {
+    return payloadValid ? master.payloadLen : 0;
+  }
+
+  // Bus cycles end each time we answer a frame addressed to us. The cycle gap
+  // is the longest time between two loop calls while bus data was pending
+  // during the last completed cycle, which is what eats into the response
+  // window of the pump.
+  uint32_t getCycleCount() {
+    return cycleCount;
+  }
+  uint32_t getCycleGap() {
+    return cycleGap;
+  }
+
+  // micros() of the first byte of the frame passed to the received callback,
+  // and of its completion right before the callback.
+  uint32_t getFrameStartTime() {
+    return frameStartTime;
+  }
+  uint32_t getFrameCompleteTime() {
+    return frameCompleteTime;
+  }
+
+  // Whether the gateway acked or nakked the frame passed to the received
+  // callback, or for a token the gateway answered, whether the pump acked or
+  // nakked that response. Acks and naks between other devices are not counted.
+  eFrameOutcome getFrameOutcome() {
+    return frameOutcome;
+  }
+
+  // Abort a frame if no byte has arrived for this many microseconds, 0 disables.
+  void setInterByteTimeout(uint32_t timeout) {
+    interByteTimeout = timeout;
+  }
+
+  // Frames of a bus other than 0 carry the bus id in the second byte, which
+  // is always 0 on the line, with the checksum recomputed to match. Addresses
+  // passed to callbacks and acknowledge settings include the id as high byte.
+  void setBusId(uint8_t id) {
+    busId = id;
+  }
+  uint8_t getBusId() {
+    return busId;
+  }
+
+  void setAcknowledge(uint16_t address, bool val) {
+    if ((address >> 8) != busId)
+      return;
     if (val)
-      addressAcknowledge.insert(address);
+      addressAcknowledge[(address & 0xff) >> 3] |= 1 << (address & 7);
     else
-      addressAcknowledge.erase(address);
+      addressAcknowledge[(address & 0xff) >> 3] &= ~(1 << (address & 7));
+  }
+
+  // Add the addresses of a generated 256 bit mask to the acknowledged ones.
+  void setAcknowledgeMask(const uint8_t mask[32]) {
+    for (int i = 0; i < 32; i++)
+      addressAcknowledge[i] |= mask[i];
   }
 
   void setAckModbus40Address(bool val) {
@@ -0,0 +1,127 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include "NibeGwAggregator.h"
+#include "NibeGwComponent.h"
+
+namespace esphome {
+namespace nibegw {
+
+static const char *TAG = "nibegw.aggregate";
+
+static const size_t AGGREGATE_HEADER_LEN = 5;
+static const size_t AGGREGATE_ENTRY_LEN = 20;
+
+static uint8_t *put_u16(uint8_t *data, uint16_t value) {
+  data[0] = value >> 8;
+  data[1] = value & 0xff;
+  return data + 2;
+}
+
+static uint8_t *put_float(uint8_t *data, float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  data[0] = bits >> 24;
+  data[1] = bits >> 16;
+  data[2] = bits >> 8;
+  data[3] = bits;
+  return data + 4;
+}
+
+void NibeGwAggregator::setup() {
+  auto &registers = gw_->registers();
+  for (auto &entry : entries_) {
+    registers.add_listener(entry.address,
+                           [this, &entry](const register_entry_type &reg) { handle_register(entry, reg); });
+  }
+  window_start_ = millis();
+  record_start_ = window_start_;
+}
+
+void NibeGwAggregator::handle_register(aggregate_entry_type &entry, const register_entry_type &reg) {
+  if (reg.stale) {
+    return;
+  }
+  float value = get_register_value(reg.value, entry.type);
+  if (std::isnan(value)) {
+    return;
+  }
+
+  if (!entry.samples) {
+    entry.min = value;
+    entry.max = value;
+    entry.sum = 0;
+  } else {
+    entry.min = std::min(entry.min, value);
+    entry.max = std::max(entry.max, value);
+  }
+  entry.sum += value;
+  entry.last = value;
+  if (entry.samples < UINT16_MAX) {
+    entry.samples++;
+  }
+}
+
+void NibeGwAggregator::send_record(uint32_t elapsed) {
+  uint8_t record[AGGREGATE_HEADER_LEN + AGGREGATE_REGISTERS_MAX * AGGREGATE_ENTRY_LEN];
+  uint8_t *pos = record;
+  *pos++ = AGGREGATE_RECORD_START;
+  *pos++ = AGGREGATE_RECORD_VERSION;
+  pos = put_u16(pos, std::min<uint32_t>((elapsed + 500) / 1000, UINT16_MAX));
+  uint8_t &count = *pos++;
+  count = 0;
+
+  /* registers without samples in the window are left out */
+  for (auto &entry : entries_) {
+    if (!entry.samples || count >= AGGREGATE_REGISTERS_MAX) {
+      continue;
+    }
+    pos = put_u16(pos, entry.address);
+    pos = put_u16(pos, entry.samples);
+    pos = put_float(pos, entry.min);
+    pos = put_float(pos, entry.max);
+    pos = put_float(pos, entry.sum / entry.samples);
+    pos = put_float(pos, entry.last);
+    entry.samples = 0;
+    count++;
+  }
+
+  if (!count) {
+    return;
+  }
+
+  for (auto &target : targets_) {
+    gw_->send_datagram(target, record, pos - record);
+  }
+  records_++;
+}
+
+void NibeGwAggregator::loop() {
+  /* sending can wait until the bus is out of trouble, samples keep accumulating meanwhile */
+  uint32_t now = millis();
+  if (now - window_start_ < window_ || gw_->is_shedding()) {
+    return;
+  }
+  /* stay on the window grid, but start over after missing whole windows instead of sending a burst */
+  window_start_ += window_;
+  if (now - window_start_ >= window_) {
+    window_start_ = now;
+  }
+  send_record(now - record_start_);
+  record_start_ = now;
+}
+
+void NibeGwAggregator::dump_config() {
+  ESP_LOGCONFIG(TAG, " Aggregating %zu registers over %u ms, records sent: %u", entries_.size(), (unsigned) window_,
+                (unsigned) records_);
+  for (auto &target : targets_) {
+    ESP_LOGCONFIG(TAG, "  Target: %s", target.str().c_str());
+  }
+}
+
+}  // namespace nibegw
+}  // namespace esphome
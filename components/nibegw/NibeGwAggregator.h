@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "NibeGwRegisters.h"
+#include "NibeGwSockAddress.h"
+
+namespace esphome {
+namespace nibegw {
+
+class NibeGwComponent;
+
+static const uint8_t AGGREGATE_RECORD_START = 0xFD;
+static const uint8_t AGGREGATE_RECORD_VERSION = 0x01;
+static const size_t AGGREGATE_REGISTERS_MAX = 32;
+
+// Folds register updates into min/max/mean/last per register over a fixed
+// window and sends one compact record per window to its own targets, so a
+// historian need not receive every telegram.
+//
+// Record: FD 01 WINDOW_S(2) COUNT then COUNT entries of
+//         ADDR(2) SAMPLES(2) MIN(4) MAX(4) MEAN(4) LAST(4)
+// with integers and IEEE 754 floats big endian. WINDOW_S is the time the
+// samples actually cover, longer than the window when sending was delayed.
+class NibeGwAggregator {
+ public:
+  explicit NibeGwAggregator(NibeGwComponent *gw) : gw_(gw) {}
+
+  void set_window(uint32_t window) {
+    window_ = window;
+  }
+
+  void add_register(uint16_t address, register_type type) {
+    entries_.push_back({address, type});
+  }
+
+  void add_target(const network::IPAddress &ip, int port) {
+    targets_.push_back(socket_address(ip, port));
+  }
+
+  void setup();
+  void loop();
+  void dump_config();
+
+ protected:
+  struct aggregate_entry_type {
+    uint16_t address;
+    register_type type;
+    uint16_t samples = 0;
+    float min = 0;
+    float max = 0;
+    float sum = 0;
+    float last = 0;
+  };
+
+  void handle_register(aggregate_entry_type &entry, const register_entry_type &reg);
+  void send_record(uint32_t elapsed);
+
+  NibeGwComponent *gw_;
+  uint32_t window_ = 60 * 1000;
+  uint32_t window_start_ = 0;  /* start of the current window on the window grid */
+  uint32_t record_start_ = 0;  /* millis() the samples of the next record started at */
+  uint32_t records_ = 0;
+  std::vector<aggregate_entry_type> entries_;
+  std::vector<socket_address> targets_;
+};
+
+}  // namespace nibegw
+}  // namespace esphome
@@ -1,14 +1,15 @@
 #pragma once
 
-#include <map>
-#include <vector>
 #include <cstddef>
+#include <cstdint>
 
 #include "esphome/core/component.h"
 #include "esphome/core/automation.h"
 #include "esphome/components/climate/climate.h"
 #include "esphome/components/sensor/sensor.h"
 
+#include "NibeGwRmu.h"
+
 namespace esphome {
 namespace nibegw {
 
@@ -17,6 +18,7 @@ class NibeGwComponent;
 class NibeGwClimate : public climate::Climate, public Component {
  public:
   void setup() override;
+  void loop() override;
   void dump_config() override;
   void set_sensor(sensor::Sensor *sensor) {
     this->sensor_ = sensor;
@@ -24,23 +26,36 @@ class NibeGwClimate : public climate::Climate, public Component {
   void set_gw(NibeGwComponent *gw) {
     this->gw_ = gw;
   }
+  void set_hysteresis(float hysteresis) {
+    this->hysteresis_ = hysteresis;
+  }
+  void set_min_interval(uint32_t interval) {
+    this->min_interval_ = interval;
+  }
+  void set_max_interval(uint32_t interval) {
+    this->max_interval_ = interval;
+  }
   void set_system(int system) {
     this->index_ = system - 1;
     this->address_ = 0x19 + this->index_;
   }
 
+  // Decoded values from the pump, called by the rmu engine.
+  void handle_rmu_target(float target);
+  void handle_rmu_current(float current);
+
+  // Send a set point decided on the device, such as by a rule, and show it as the target.
+  void apply_set_point(float value);
+
  protected:
   /// Override control to change settings of the climate device.
   void control(const climate::ClimateCall &call) override;
+  float sensor_value();
+  void on_sensor_update();
   void publish_current_temperature();
   void publish_current_temperature(float value);
   void publish_set_point(float value);
   void restart_timeout_on_data();
-  void restart_timeout_on_sensor();
-
-  typedef std::map<int, std::vector<uint8_t>> data_index_map_t;
-
-  data_index_map_t::iterator next_data(); /* return next data index */
 
   /// Return the traits of this controller.
   climate::ClimateTraits traits() override;
@@ -49,8 +64,13 @@ class NibeGwClimate : public climate::Climate, public Component {
   sensor::Sensor *sensor_{nullptr};
   int address_;
   int index_;
-  int data_index_; /* last transmitted data index */
-  data_index_map_t data_;
+  bool publish_pending_{false};
+  float hysteresis_{0.1};
+  uint32_t min_interval_{1000};
+  uint32_t max_interval_{10000};
+  uint32_t sent_time_{0};
+  int16_t sent_raw_{0};
+  bool sensor_pending_{false};
 };
 
 }  // namespace nibegw
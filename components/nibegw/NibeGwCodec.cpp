@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <cmath>
+
+#include "NibeGwCodec.h"
+#include "NibeGw.h"
+
+namespace esphome {
+namespace nibegw {
+
+int build_request_data(uint8_t token, const uint8_t *payload, size_t len, uint8_t *data) {
+  data[0] = STARTBYTE_SLAVE;
+  data[1] = token;
+  data[2] = (uint8_t) len;
+  std::copy_n(payload, len, &data[3]);
+
+  uint8_t checksum = 0;
+  for (size_t i = 0; i < len + 3; i++)
+    checksum ^= data[i];
+  if (checksum == 0x5c)
+    checksum = 0xc5;
+  data[len + 3] = checksum;
+  return len + 4;
+}
+
+request_data_type build_request_data(uint8_t token, request_data_type payload) {
+  request_data_type data(payload.size() + 4);
+  build_request_data(token, payload.data(), payload.size(), data.data());
+  return data;
+}
+
+request_data_type set_u16_index(int index, int value) {
+  return {(uint8_t) index, (uint8_t) (value & 0xff), (uint8_t) ((value >> 8) & 0xff)};
+}
+
+request_data_type set_u16(int value) {
+  return {(uint8_t) (value & 0xff), (uint8_t) ((value >> 8) & 0xff)};
+}
+
+uint16_t get_u16(const uint8_t data[2]) {
+  return (uint16_t) data[0] | ((uint16_t) data[1] << 8);
+}
+
+float get_s16_decimal(uint16_t data, float scale, int offset) {
+  auto value = (int) (int16_t) data;
+
+  value += offset;
+  if (value <= int16_invalid) {
+    return NAN;
+  }
+
+  return value * scale;
+}
+
+float get_s16_decimal(const uint8_t data[2], float scale, int offset) {
+  return get_s16_decimal(get_u16(data), scale, offset);
+}
+
+// Round value divided by scale and clamp it to [min, max], so out of range values saturate instead of wrapping.
+static int64_t scale_clamped(float value, float scale, int64_t min, int64_t max) {
+  return (int64_t) std::clamp<double>(std::round((double) value / scale), min, max);
+}
+
+void set_s16_decimal(float value, float scale, int offset, uint8_t result[2]) {
+  int data;
+  if (std::isnan(value)) {
+    data = int16_invalid;
+  } else {
+    data = (int) std::clamp<int64_t>(scale_clamped(value, scale, INT32_MIN, INT32_MAX) - offset, int16_invalid + 1,
+                                     INT16_MAX);
+  }
+  auto raw = (uint16_t) (int16_t) data;
+  result[0] = raw & 0xff;
+  result[1] = (raw >> 8) & 0xff;
+}
+
+request_data_type set_s16_decimal(float value, float scale, int offset) {
+  request_data_type result(2);
+  set_s16_decimal(value, scale, offset, result.data());
+  return result;
+}
+
+float get_u8_decimal(const uint8_t data[1], float scale, int offset) {
+  int value = (int) data[0];
+  value += offset;
+  if (value >= uint8_invalid) {
+    return NAN;
+  }
+  return value * scale;
+}
+
+request_data_type set_u8_decimal(float value, float scale, int offset) {
+  int data;
+  if (std::isnan(value)) {
+    data = uint8_invalid;
+  } else {
+    data = (int) std::clamp<int64_t>(scale_clamped(value, scale, INT32_MIN, INT32_MAX) - offset, 0, uint8_invalid - 1);
+  }
+  return {(uint8_t) data};
+}
+
+float get_register_value(uint32_t raw, register_type type) {
+  switch (type) {
+    case REGISTER_TYPE_U8:
+      return (uint8_t) raw;
+    case REGISTER_TYPE_S8:
+      if ((int8_t) raw == int8_invalid)
+        return NAN;
+      return (int8_t) raw;
+    case REGISTER_TYPE_U16:
+      return (uint16_t) raw;
+    case REGISTER_TYPE_S16:
+      if ((int16_t) raw == int16_invalid)
+        return NAN;
+      return (int16_t) raw;
+    case REGISTER_TYPE_U32:
+      return raw;
+    case REGISTER_TYPE_S32:
+      if ((int32_t) raw == INT32_MIN)
+        return NAN;
+      return (int32_t) raw;
+  }
+  return NAN;
+}
+
+uint32_t set_register_value(float value, float scale, register_type type) {
+  uint8_t data[2];
+  switch (type) {
+    case REGISTER_TYPE_U8:
+      return set_u8_decimal(value, scale, 0)[0];
+    case REGISTER_TYPE_S8:
+      if (std::isnan(value)) {
+        return (uint32_t) int8_invalid;
+      }
+      return (uint32_t) (int32_t) scale_clamped(value, scale, int8_invalid + 1, INT8_MAX);
+    case REGISTER_TYPE_U16:
+      if (std::isnan(value)) {
+        return (uint16_t) int16_invalid;
+      }
+      return (uint32_t) scale_clamped(value, scale, 0, UINT16_MAX);
+    case REGISTER_TYPE_S16:
+      set_s16_decimal(value, scale, 0, data);
+      return (uint32_t) (int32_t) (int16_t) get_u16(data);
+    case REGISTER_TYPE_U32:
+      if (std::isnan(value)) {
+        return (uint32_t) INT32_MIN;
+      }
+      return (uint32_t) scale_clamped(value, scale, 0, UINT32_MAX);
+    case REGISTER_TYPE_S32:
+      if (std::isnan(value)) {
+        return (uint32_t) INT32_MIN;
+      }
+      return (uint32_t) (int32_t) scale_clamped(value, scale, INT32_MIN + 1, INT32_MAX);
+  }
+  return 0;
+}
+
+}  // namespace nibegw
+}  // namespace esphome
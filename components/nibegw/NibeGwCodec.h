@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace nibegw {
+
+typedef std::vector<uint8_t> request_data_type;
+
+const int int16_invalid = -0x8000;
+const int int8_invalid = -0x80;
+const int uint8_invalid = 0xFF;
+
+enum register_type {
+  REGISTER_TYPE_U8,
+  REGISTER_TYPE_S8,
+  REGISTER_TYPE_U16,
+  REGISTER_TYPE_S16,
+  REGISTER_TYPE_U32,
+  REGISTER_TYPE_S32,
+};
+
+// Interpret a raw register value as type, NAN for the invalid marker of signed types.
+float get_register_value(uint32_t raw, register_type type);
+
+// Encode value divided by scale as a raw register value of type, sign extended for signed types. Values out of
+// range saturate at the limits of the type, NAN encodes as the invalid marker.
+uint32_t set_register_value(float value, float scale, register_type type);
+
+// Build a complete slave frame (start, token, length, payload, checksum) into
+// data, which must hold len + 4 bytes. Returns the frame length.
+int build_request_data(uint8_t token, const uint8_t *payload, size_t len, uint8_t *data);
+request_data_type build_request_data(uint8_t token, request_data_type payload);
+
+request_data_type set_u16_index(int index, int value);
+request_data_type set_u16(int value);
+uint16_t get_u16(const uint8_t data[2]);
+
+float get_s16_decimal(uint16_t data, float scale, int offset);
+float get_s16_decimal(const uint8_t data[2], float scale, int offset);
+void set_s16_decimal(float value, float scale, int offset, uint8_t result[2]);
+request_data_type set_s16_decimal(float value, float scale, int offset);
+
+float get_u8_decimal(const uint8_t data[1], float scale, int offset);
+request_data_type set_u8_decimal(float value, float scale, int offset);
+
+}  // namespace nibegw
+}  // namespace esphome
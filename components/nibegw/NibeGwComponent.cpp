@@ -7,86 +7,727 @@ namespace nibegw {
 NibeGwComponent::NibeGwComponent(esphome::GPIOPin *dir_pin) {
   gw_ = new NibeGw(this, dir_pin);
   gw_->setCallback(
-      std::bind(&NibeGwComponent::callback_msg_received, this, std::placeholders::_1, std::placeholders::_2),
+      std::bind(&NibeGwComponent::callback_msg_received, this, gw_, std::placeholders::_1, std::placeholders::_2),
       std::bind(&NibeGwComponent::callback_msg_token_received, this, std::placeholders::_1, std::placeholders::_2,
                 std::placeholders::_3));
+  buses_[0] = {gw_, nullptr};
 }
 
-static request_data_type dedup(const uint8_t *data, int len, uint8_t val) {
-  request_data_type message;
-  uint8_t value = ~val;
-  for (int i = 5; i < len - 1; i++) {
-    if (data[i] == val && value == val) {
-      value = ~val;
-      continue;
-    }
-    value = data[i];
-    message.push_back(value);
+void NibeGwComponent::add_bus(uint8_t bus, uart::UARTComponent *parent, esphome::GPIOPin *dir_pin) {
+  /* all buses share routing, the bus id in the address keeps their queues, listeners and replies apart */
+  auto *gw = new NibeGw(new uart::UARTDevice(parent), dir_pin);
+  gw->setBusId(bus);
+  gw->setCallback(
+      std::bind(&NibeGwComponent::callback_msg_received, this, gw, std::placeholders::_1, std::placeholders::_2),
+      std::bind(&NibeGwComponent::callback_msg_token_received, this, std::placeholders::_1, std::placeholders::_2,
+                std::placeholders::_3));
+  buses_[bus] = {gw, parent};
+}
+
+void NibeGwComponent::add_acknowledge(int address) {
+  const auto &it = buses_.find(address >> 8);
+  if (it == buses_.end()) {
+    ESP_LOGE(TAG, "No bus %d for acknowledge of address 0x%x", address >> 8, address & 0xff);
+    return;
   }
-  return message;
+  it->second.gw->setAcknowledge(address, true);
 }
 
-void NibeGwComponent::callback_msg_received(const uint8_t *data, int len) {
-  {
+void NibeGwComponent::set_acknowledge_mask(uint8_t bus, const uint8_t *mask) {
+  const auto &it = buses_.find(bus);
+  if (it == buses_.end()) {
+    ESP_LOGE(TAG, "No bus %d for acknowledge mask", bus);
+    return;
+  }
+  it->second.gw->setAcknowledgeMask(mask);
+}
+
+// The uart driver hands bytes over in bursts after its own receive timeout of
+// a few character times, so the default gap allows for that with margin.
+static const uint32_t INTER_BYTE_TIMEOUT_CHARS = 20;
+
+static const size_t FRAME_POOL_DEFAULT = 16;
+
+void NibeGwComponent::callback_msg_received(NibeGw *gw, const uint8_t *data, int len) {
+  if (const uint8_t *payload = gw->getPayload()) {
     request_key_type key{data[2] | (data[1] << 8), static_cast<uint8_t>(data[3])};
     const auto &it = message_listener_.find(key);
     if (it != message_listener_.end()) {
-      it->second(dedup(data, len, STARTBYTE_MASTER));
+      it->second(request_data_type(payload, payload + gw->getPayloadLength()));
     }
   }
 
+  handle_pending_reply(data, len);
+
+  if (len >= 6 && data[4] == 0) {
+    learn_schedule(request_key_type{data[2] | (data[1] << 8), data[3]}, millis());
+  }
+
+#ifdef USE_HOST
+  /* no syscalls involved, so local readers get every frame even while shedding */
+  if (shared_ring_) {
+    shared_ring_->write_frame(gw->getBusId(), gw->getFrameCompleteTime(), data, len);
+  }
+#endif
+
   if (!is_connected_) {
     return;
   }
 
+  len = std::min<int>(len, MAX_DATA_LEN * 2);
+  if (shedding_) {
+    defer_frame(gw, data, len);
+    return;
+  }
+
+  if (!envelope_targets_) {
+    send_frame(nullptr, data, len);
+    memory_.sample_heap();
+    return;
+  }
+
+  uint8_t packet[ENVELOPE_HEADER_LEN + MAX_DATA_LEN * 2];
+  write_envelope(gw, packet);
+  std::copy_n(data, len, &packet[ENVELOPE_HEADER_LEN]);
+  send_frame(packet, &packet[ENVELOPE_HEADER_LEN], len);
+  memory_.sample_heap();
+}
+
+static uint8_t *put_u32(uint8_t *data, uint32_t value) {
+  data[0] = value >> 24;
+  data[1] = value >> 16;
+  data[2] = value >> 8;
+  data[3] = value;
+  return data + 4;
+}
+
+void NibeGwComponent::write_envelope(NibeGw *gw, uint8_t *header) {
+  uint8_t outcome = ENVELOPE_OUTCOME_NONE;
+  if (gw->getFrameOutcome() == FRAME_OUTCOME_ACK) {
+    outcome = ENVELOPE_OUTCOME_ACK;
+  } else if (gw->getFrameOutcome() == FRAME_OUTCOME_NAK) {
+    outcome = ENVELOPE_OUTCOME_NAK;
+  }
+
+  *header++ = ENVELOPE_START;
+  *header++ = ENVELOPE_VERSION;
+  header = put_u32(header, envelope_seq_++);
+  header = put_u32(header, gw->getFrameStartTime());
+  header = put_u32(header, gw->getFrameCompleteTime());
+  *header++ = gw->getBusId();
+  *header++ = outcome;
+}
+
+void NibeGwComponent::send_frame(const uint8_t *packet, const uint8_t *data, size_t len) {
+  if (tcp_) {
+    tcp_->send_frame(data, len);
+  }
+
   /* always sending standard data from modbus read token */
-  auto &udp_read_ = requests_sockets_[request_key_type(MODBUS40, READ_TOKEN)].socket;
+  auto *udp_read_ = read_socket();
   if (!udp_read_) {
     ESP_LOGW(TAG, "UDP read socket not available");
     return;
   }
 
   // Send to all UDP targets
-  for (auto &&[target, timestamp] : udp_targets_) {
-    int result = udp_read_->sendto(data, len, 0, (sockaddr *) &target.storage, target.len);
+  uint32_t start = micros();
+  socket_address to;
+  for (auto &target : udp_targets_) {
+    if (target.envelope && !packet) {
+      continue;
+    }
+    target.endpoint.to_address(to);
+    int result = target.envelope ? udp_read_->sendto(packet, ENVELOPE_HEADER_LEN + len, 0, (sockaddr *) &to.storage,
+                                                     to.len)
+                                 : udp_read_->sendto(data, len, 0, (sockaddr *) &to.storage, to.len);
     if (result < 0) {
-      ESP_LOGW(TAG, "UDP sendto failed to %s, error: %d", target.str().c_str(), errno);
+      ESP_LOGW(TAG, "UDP sendto failed to %s, error: %d", to.str().c_str(), errno);
     }
   }
+
+  if (!udp_targets_.empty()) {
+    uint32_t elapsed = micros() - start;
+    stats_.frames++;
+    stats_.fanout_targets = std::min<size_t>(udp_targets_.size(), UINT8_MAX);
+    stats_.fanout_avg = (stats_.fanout_avg * 7 + elapsed / udp_targets_.size()) / 8;
+    stats_.fanout_max = std::max(stats_.fanout_max, elapsed);
+  }
 }
 
-void NibeGwComponent::recv_local_socket(std::unique_ptr<socket::Socket> &fd, int address, int token) {
-  request_data_type request(MAX_DATA_LEN);
+void NibeGwComponent::send_datagram(const socket_address &to, const uint8_t *data, size_t len) {
+  auto *udp_read_ = read_socket();
+  if (!udp_read_) {
+    ESP_LOGW(TAG, "UDP read socket not available");
+    return;
+  }
+
+  if (udp_read_->sendto(data, len, 0, (sockaddr *) &to.storage, to.len) < 0) {
+    ESP_LOGW(TAG, "UDP sendto failed to %s, error: %d", to.str().c_str(), errno);
+  }
+}
+
+void NibeGwComponent::defer_frame(NibeGw *gw, const uint8_t *data, int len) {
+  if (deferred_count_ == deferred_frames_max_) {
+    /* overwrite the oldest frame */
+    deferred_head_ = (deferred_head_ + 1) % deferred_frames_max_;
+    deferred_count_--;
+    shed_dropped_++;
+    deferred_dropped_++;
+  }
+  /* the envelope is added now, as an envelope target may show up before the flush, and frames deferred and then
+   * dropped leave a gap in the sequence */
+  auto &frame = deferred_frames_[(deferred_head_ + deferred_count_) % deferred_frames_max_];
+  write_envelope(gw, frame.data);
+  memcpy(&frame.data[ENVELOPE_HEADER_LEN], data, len);
+  frame.len = len;
+  deferred_count_++;
+}
+
+void NibeGwComponent::flush_deferred_frames() {
+  while (deferred_count_) {
+    auto &frame = deferred_frames_[deferred_head_];
+    send_frame(frame.data, &frame.data[ENVELOPE_HEADER_LEN], frame.len);
+    deferred_head_ = (deferred_head_ + 1) % deferred_frames_max_;
+    deferred_count_--;
+  }
+}
+
+void NibeGwComponent::log_stats() {
+  ESP_LOGI(TAG,
+           "Stats: received %u accepted %u rejected source %u rate %u invalid %u pool %u full %u, queue dropped %u, "
+           "sent %u, latency avg %u us max %u us, frames %u to %u targets avg %u us/target max %u us",
+           (unsigned) stats_.received, (unsigned) stats_.accepted, (unsigned) stats_.rejected_source,
+           (unsigned) stats_.rejected_rate, (unsigned) stats_.rejected_invalid, (unsigned) stats_.rejected_pool,
+           (unsigned) stats_.rejected_full, (unsigned) stats_.queue_dropped, (unsigned) stats_.sent,
+           (unsigned) stats_.latency_avg, (unsigned) stats_.latency_max, (unsigned) stats_.frames,
+           stats_.fanout_targets, (unsigned) stats_.fanout_avg, (unsigned) stats_.fanout_max);
+  stats_.latency_max = 0;
+  stats_.fanout_max = 0;
+}
+
+void NibeGwComponent::update_memory() {
+  size_t queued = 0;
+  for (auto &[key, queue] : requests_) {
+    queued += queue.size();
+  }
+  memory_.update(MEMORY_REQUESTS, queued, map_bytes(requests_));
+
+  size_t writers = 0;
+  size_t bytes = map_bytes(requests_provider_);
+  for (auto &[key, chain] : requests_provider_) {
+    writers += chain.size();
+    bytes += vector_bytes(chain);
+  }
+  memory_.update(MEMORY_PROVIDERS, writers, bytes);
+
+  memory_.update(MEMORY_LISTENERS, message_listener_.size(), map_bytes(message_listener_));
+
+  bytes = vector_bytes(udp_targets_);
+  for (auto &slot : target_wheel_) {
+    bytes += vector_bytes(slot);
+  }
+  memory_.update(MEMORY_TARGETS, udp_targets_.size(), bytes);
+
+  memory_.update(MEMORY_PENDING_REPLIES, pending_replies_.size(), map_bytes(pending_replies_));
+  memory_.update(MEMORY_SCHEDULE, schedule_.size(), map_bytes(schedule_));
 
+  /* the ring is allocated once, its size does not change with the frames held */
+  bytes = deferred_frames_ ? deferred_frames_max_ * sizeof(deferred_frame_type) : 0;
+  memory_.update(MEMORY_DEFERRED_FRAMES, deferred_count_, bytes);
+
+  if (registers_) {
+    memory_.update(MEMORY_REGISTERS, registers_->size(), registers_->memory_bytes());
+  }
+}
+
+void NibeGwComponent::learn_schedule(const request_key_type &key, uint32_t now) {
+  /* only tokens we can answer are worth waking up for */
+  if (!requests_provider_.count(key) && find_route(key) < 0 && !find_constant(key)) {
+    return;
+  }
+
+  auto &entry = schedule_[key];
+  uint32_t interval = now - entry.last;
+  entry.last = now;
+
+  if (entry.period && interval + entry.period / 8 >= entry.period && interval <= entry.period + entry.period / 8) {
+    entry.period = (entry.period * 7 + interval) / 8;
+    if (entry.hits < UINT8_MAX) {
+      entry.hits++;
+    }
+  } else {
+    entry.period = interval;
+    entry.hits = 0;
+  }
+}
+
+bool NibeGwComponent::run_schedule(uint32_t now) {
+  bool expected = false;
+  for (auto &[key, entry] : schedule_) {
+    if (entry.hits < schedule_hits_min_ || entry.period <= schedule_lead_ms_ + schedule_tolerance_ms_) {
+      continue;
+    }
+
+    uint32_t since = now - entry.last;
+    if (since > entry.period * 4) {
+      /* pump stopped polling, relearn from scratch */
+      entry.hits = 0;
+      continue;
+    }
+
+    uint32_t phase = since % entry.period;
+    if (phase < entry.period - schedule_lead_ms_ && phase > schedule_tolerance_ms_) {
+      continue;
+    }
+    expected = true;
+  }
+  return expected;
+}
+
+int NibeGwComponent::write_provided_request(const request_key_type &key, uint8_t *data) {
+  const auto &it = requests_provider_.find(key);
+  if (it == requests_provider_.end()) {
+    return 0;
+  }
+  for (auto &writer : it->second) {
+    int len = writer(data);
+    if (len > 0) {
+      return len;
+    }
+  }
+  return 0;
+}
+
+void NibeGwComponent::update_load_shedding(uint32_t now) {
+  if (!response_deadline_) {
+    return;
+  }
+
+  /* all buses share the loop, so the tightest one decides */
+  for (auto &[id, bus] : buses_) {
+    if (bus.gw->getCycleCount() == bus.shed_cycle) {
+      continue;
+    }
+    bus.shed_cycle = bus.gw->getCycleCount();
+    slack_ = (int32_t) response_deadline_ - (int32_t) bus.gw->getCycleGap();
+    slack_min_ = std::min(slack_min_, slack_);
+
+    if (slack_ < (int32_t) min_slack_) {
+      if (!shedding_) {
+        ESP_LOGW(TAG, "Bus %u slack %d us below %u us, shedding load", id, slack_, (unsigned) min_slack_);
+        shed_count_++;
+      }
+      shedding_ = true;
+      shed_until_ = now + shed_hold_ms_;
+    }
+  }
+
+  if (shedding_ && (int32_t) (now - shed_until_) >= 0) {
+    if (shed_dropped_) {
+      ESP_LOGW(TAG, "Bus slack recovered, %zu deferred frames, %u dropped from the full deferral queue",
+               deferred_count_, (unsigned) shed_dropped_);
+    } else {
+      ESP_LOGI(TAG, "Bus slack recovered, %zu deferred frames", deferred_count_);
+    }
+    shed_dropped_ = 0;
+    shedding_ = false;
+  }
+}
+
+void NibeGwComponent::recv_local_socket(std::unique_ptr<socket::Socket> &fd, int address, int token) {
+  /* the source is only known once the datagram is read, so a request is copied into a pooled frame after passing
+   * the source policy and validation, a flood from one source never gets to claim frames */
+  uint8_t buffer[MAX_DATA_LEN];
   socket_address from;
-  int n = fd->recvfrom(request.data(), request.size(), (sockaddr *) &from.storage, &from.len);
+  int n = fd->recvfrom(buffer, sizeof(buffer), (sockaddr *) &from.storage, &from.len);
   if (n < 0) {
     if (errno != EAGAIN && errno != EWOULDBLOCK) {
       ESP_LOGW(TAG, "recvfrom error on read socket: %d", errno);
     }
     return;
   }
-  request.resize(n);
+  stats_.received++;
 
-  if (udp_sources_.size() &&
-      none_of(udp_sources_.begin(), udp_sources_.end(), [&](auto &source) { return from.matches(source); })) {
-    ESP_LOGW(TAG, "UDP Packet wrong ip ignored %s", from.str().c_str());
-    return;
+  if (!udp_sources_.empty()) {
+    auto *source = find_source(from);
+    if (!source) {
+      ESP_LOGW(TAG, "UDP Packet wrong ip ignored %s", from.str().c_str());
+      stats_.rejected_source++;
+      return;
+    }
+    if (!source->take(millis())) {
+      ESP_LOGV(TAG, "UDP Packet over rate ignored %s", from.str().c_str());
+      source->limited++;
+      stats_.rejected_rate++;
+      return;
+    }
+    source->accepted++;
   }
 
-  if (gw_->checkSlaveData(request.data(), request.size()) != PACKET_OK) {
+  /* replies only go to senders that matched a source policy above, status_replies requires a source list */
+  request_key_type key(address, token);
+  uint32_t now = millis();
+  if (gw_->checkSlaveData(buffer, n) != PACKET_OK) {
     ESP_LOGW(TAG, "Received invalid packet from %s, %d bytes", from.str().c_str(), n);
+    stats_.rejected_invalid++;
+    if (status_replies_) {
+      send_queue_reply(from, key, REQUEST_STATUS_INVALID, STATUS_REPLY_NO_POSITION, now);
+    }
+    return;
+  }
+
+  /* with replies the sender learns about a full queue and can retry, so the new request is refused instead
+   * of silently pushing out the oldest */
+  if (status_replies_ && queue_full(key)) {
+    ESP_LOGV(TAG, "Queue full, refused request from %s", from.str().c_str());
+    stats_.rejected_full++;
+    send_queue_reply(from, key, REQUEST_STATUS_DROPPED, STATUS_REPLY_NO_POSITION, now);
+    return;
+  }
+
+  auto frame = pool_->acquire();
+  if (!frame) {
+    ESP_LOGW(TAG, "Frame pool exhausted, dropped request from %s", from.str().c_str());
+    stats_.rejected_pool++;
+    if (status_replies_) {
+      send_queue_reply(from, key, REQUEST_STATUS_DROPPED, STATUS_REPLY_NO_POSITION, now);
+    }
     return;
   }
+  frame.resize(n);
+  std::copy_n(buffer, n, frame.data());
 
   /* store this as a new target */
-  uint32_t now = millis();
-  auto [it, inserted] = udp_targets_.insert_or_assign(from, now);
-  if (inserted) {
-    ESP_LOGI(TAG, "New target added %s", from.str().c_str());
+  add_udp_target(socket_endpoint(from), now, false, envelope_);
+
+  request_reply_type reply;
+  if (status_replies_ && token == WRITE_TOKEN) {
+    reply = [this, from, key](request_status_type status, const uint8_t *data, int len) {
+      send_status_reply(from, key, STATUS_REPLY_COMPLETED, status, data, len);
+    };
   }
 
-  add_queued_request(address, token, std::move(request));
+  stats_.accepted++;
+  add_queued_request(address, token, std::move(frame), std::move(reply));
+
+  if (status_replies_) {
+    const auto &queue = requests_.find(key);
+    if (queue != requests_.end() && !queue->second.empty()) {
+      send_queue_reply(from, key, REQUEST_STATUS_OK, queue->second.size() - 1, now);
+    }
+  }
+}
+
+static bool target_less(const target_type &target, const socket_endpoint &key) {
+  return target.endpoint < key;
+}
+
+void NibeGwComponent::add_udp_target(const socket_endpoint &endpoint, uint32_t now, bool permanent, bool envelope) {
+  auto it = std::lower_bound(udp_targets_.begin(), udp_targets_.end(), endpoint, target_less);
+  if (it != udp_targets_.end() && it->endpoint == endpoint) {
+    /* the armed wheel entry finds the new deadline when it fires */
+    it->expires = now + target_timeout_ms_;
+    if (permanent) {
+      it->permanent = true;
+      envelope_targets_ += (int) envelope - (int) it->envelope;
+      it->envelope = envelope;
+    }
+    return;
+  }
+
+  if (!permanent && udp_targets_.size() >= max_targets_) {
+    ESP_LOGW(TAG, "Target limit of %u reached, ignoring %s", (unsigned) max_targets_, endpoint.str().c_str());
+    memory_.reject(MEMORY_TARGETS);
+    return;
+  }
+
+  it = udp_targets_.insert(it, {endpoint, now + target_timeout_ms_, permanent, envelope});
+  envelope_targets_ += envelope;
+  if (!permanent) {
+    ESP_LOGI(TAG, "New target added %s", endpoint.str().c_str());
+    arm_udp_target(*it);
+  }
+}
+
+void NibeGwComponent::arm_udp_target(const target_type &target) {
+  /* round up, so the slot fires no earlier than the deadline */
+  uint32_t tick = (target.expires + target_wheel_tick_ms_ - 1) / target_wheel_tick_ms_;
+  target_wheel_[tick % target_wheel_slots_].push_back(target.endpoint);
+}
+
+void NibeGwComponent::create_registers(int capacity) {
+  registers_ = std::make_unique<NibeGwRegisters>(this, capacity);
+#ifdef USE_HOST
+  /* the ring is configured and opened independently of the registers, so it is looked up on every update */
+  registers_->set_update_listener([this](const register_entry_type &entry) {
+    if (shared_ring_) {
+      shared_ring_->write_register(entry.address, entry.value, micros());
+    }
+  });
+#endif
+}
+
+void NibeGwComponent::expire_udp_targets(uint32_t now) {
+  uint32_t tick = now / target_wheel_tick_ms_;
+  if (tick == target_wheel_tick_) {
+    return;
+  }
+
+  /* after a stall, or when the tick count wraps with millis(), every slot is visited once at most */
+  int32_t elapsed = (int32_t) (tick - target_wheel_tick_);
+  uint32_t steps = elapsed > 0 && elapsed < (int32_t) target_wheel_slots_ ? elapsed : target_wheel_slots_;
+  target_wheel_tick_ = tick;
+  std::vector<socket_endpoint> due;
+  for (uint32_t step = 0; step < steps; step++) {
+    /* a target re-armed below may land in this same slot, so the slot is taken out before it is walked */
+    auto &slot = target_wheel_[(tick - step) % target_wheel_slots_];
+    due.swap(slot);
+    for (auto &endpoint : due) {
+      auto it = std::lower_bound(udp_targets_.begin(), udp_targets_.end(), endpoint, target_less);
+      if (it == udp_targets_.end() || !(it->endpoint == endpoint) || it->permanent) {
+        continue;
+      }
+      if ((int32_t) (now - it->expires) >= 0) {
+        ESP_LOGI(TAG, "Target expired %s", endpoint.str().c_str());
+        envelope_targets_ -= it->envelope;
+        udp_targets_.erase(it);
+      } else {
+        /* refreshed since it was armed, the deadline is less than a turn of the wheel ahead */
+        arm_udp_target(*it);
+      }
+    }
+    due.clear();
+    if (slot.empty()) {
+      /* hand the storage back, so the slot keeps its capacity */
+      slot.swap(due);
+    }
+  }
+}
+
+void NibeGwComponent::add_source(const network::IPAddress &ip, uint8_t prefix, uint16_t rate, uint16_t burst) {
+  socket_address address(ip, 0);
+  if (address.storage.ss_family != AF_INET) {
+    ESP_LOGE(TAG, "Only IPv4 sources are supported");
+    return;
+  }
+  source_policy_type source;
+  source.mask = prefix ? UINT32_MAX << (32 - prefix) : 0;
+  source.network = ntohl(reinterpret_cast<const sockaddr_in *>(&address.storage)->sin_addr.s_addr) & source.mask;
+  source.prefix = prefix;
+  source.rate = rate;
+  source.burst = std::max(burst, (uint16_t) 1);
+  source.tokens = source.burst * 1000;
+  source.refilled = millis();
+
+  /* keep the most specific prefix first, so the first match is the best one */
+  auto it = std::find_if(udp_sources_.begin(), udp_sources_.end(),
+                         [&](const source_policy_type &other) { return other.prefix < prefix; });
+  udp_sources_.insert(it, source);
+}
+
+source_policy_type *NibeGwComponent::find_source(const socket_address &from) {
+  if (from.storage.ss_family != AF_INET) {
+    return nullptr;
+  }
+  uint32_t address = ntohl(reinterpret_cast<const sockaddr_in *>(&from.storage)->sin_addr.s_addr);
+  for (auto &source : udp_sources_) {
+    if (source.matches(address)) {
+      return &source;
+    }
+  }
+  return nullptr;
+}
+
+void NibeGwComponent::recv_tcp_request(uint32_t client, const socket_address &peer, uint16_t seq, uint16_t address,
+                                       uint8_t token, const uint8_t *data, size_t len) {
+  stats_.received++;
+
+  /* the peer passed the source policy when it connected, the rate limit applies per request */
+  if (!udp_sources_.empty()) {
+    auto *source = find_source(peer);
+    if (!source) {
+      stats_.rejected_source++;
+      tcp_->send_reply(client, seq, REQUEST_STATUS_DROPPED, nullptr, 0);
+      return;
+    }
+    if (!source->take(millis())) {
+      ESP_LOGV(TAG, "TCP request over rate ignored %s", peer.str().c_str());
+      source->limited++;
+      stats_.rejected_rate++;
+      tcp_->send_reply(client, seq, REQUEST_STATUS_DROPPED, nullptr, 0);
+      return;
+    }
+    source->accepted++;
+  }
+
+  if (gw_->checkSlaveData(data, len) != PACKET_OK) {
+    ESP_LOGW(TAG, "Received invalid tcp request for address: 0x%x token: 0x%x", address, token);
+    stats_.rejected_invalid++;
+    tcp_->send_reply(client, seq, REQUEST_STATUS_INVALID, nullptr, 0);
+    return;
+  }
+
+  auto frame = pool_->acquire();
+  if (!frame) {
+    ESP_LOGW(TAG, "Frame pool exhausted, dropped tcp request for address: 0x%x token: 0x%x", address, token);
+    stats_.rejected_pool++;
+    tcp_->send_reply(client, seq, REQUEST_STATUS_DROPPED, nullptr, 0);
+    return;
+  }
+  frame.resize(len);
+  std::copy_n(data, frame.size(), frame.data());
+  stats_.accepted++;
+
+  add_queued_request(address, token, std::move(frame),
+                     [this, client, seq](request_status_type status, const uint8_t *reply, int reply_len) {
+                       if (tcp_) {
+                         tcp_->send_reply(client, seq, status, reply, reply_len);
+                       }
+                     });
+}
+
+void NibeGwComponent::handle_pending_reply(const uint8_t *data, int len) {
+  if (len < 6) {
+    return;
+  }
+
+  const uint16_t address = data[2] | (data[1] << 8);
+  if (data[4] == 0) {
+    /* the token we answered, terminated by the pumps ack or nak of our response */
+    request_key_type key{address, data[3]};
+    const auto &it = pending_replies_.find(key);
+    if (it == pending_replies_.end() || it->second.acked) {
+      return;
+    }
+    if (data[len - 1] != STARTBYTE_ACK) {
+      complete_pending_reply(key, REQUEST_STATUS_NAK, nullptr, 0);
+    } else if (data[3] == READ_TOKEN || data[3] == WRITE_TOKEN) {
+      it->second.acked = true;
+    } else {
+      /* other tokens get no answer beyond the ack */
+      complete_pending_reply(key, REQUEST_STATUS_OK, data, len);
+    }
+    return;
+  }
+
+  /* a response only answers the token of its own kind, a read and a write to the address may both be pending */
+  uint8_t token;
+  if (data[3] == READ_RESP) {
+    token = READ_TOKEN;
+  } else if (data[3] == WRITE_RESP) {
+    token = WRITE_TOKEN;
+  } else {
+    return;
+  }
+  request_key_type key{address, token};
+  if (!pending_replies_.count(key)) {
+    return;
+  }
+
+  if (token == WRITE_TOKEN && data[5] != 1) {
+    complete_pending_reply(key, REQUEST_STATUS_FAILED, data, len);
+    return;
+  }
+
+  complete_pending_reply(key, REQUEST_STATUS_OK, data, len);
+}
+
+void NibeGwComponent::complete_pending_reply(const request_key_type &key, request_status_type status,
+                                             const uint8_t *data, int len) {
+  const auto &it = pending_replies_.find(key);
+  if (it == pending_replies_.end()) {
+    return;
+  }
+  auto request = std::move(it->second.request);
+  pending_replies_.erase(it);
+  finish_request(key, std::move(request), status, data, len);
+}
+
+void NibeGwComponent::finish_request(const request_key_type &key, queued_request_type request,
+                                     request_status_type status, const uint8_t *data, int len) {
+  /* a write the pump answered with a rejection would only be rejected again */
+  bool retry = status != REQUEST_STATUS_OK && status != REQUEST_STATUS_FAILED;
+  if (retry && millis() - request.first_sent < retry_budget_ms_) {
+    auto &queue = requests_[key];
+    if (queue.size() < requests_queue_max) {
+      ESP_LOGD(TAG, "Retrying request to address: 0x%x token: 0x%x status: %d attempt: %d", std::get<0>(key),
+               std::get<1>(key), status, request.attempts);
+      queue.push_front(std::move(request));
+      return;
+    }
+  }
+
+  if (status != REQUEST_STATUS_OK) {
+    ESP_LOGW(TAG, "Request to address: 0x%x token: 0x%x failed with status: %d after %d attempts", std::get<0>(key),
+             std::get<1>(key), status, request.attempts);
+  }
+  request.reply(status, data, len);
+}
+
+void NibeGwComponent::expire_pending_replies(uint32_t now) {
+  for (auto &pending : superseded_replies_) {
+    finish_request(pending.key, std::move(pending.request), REQUEST_STATUS_TIMEOUT, nullptr, 0);
+  }
+  superseded_replies_.clear();
+
+  std::vector<request_key_type> expired;
+  for (auto &[key, pending] : pending_replies_) {
+    if (now - pending.timestamp > reply_timeout_ms_) {
+      expired.push_back(key);
+    }
+  }
+  for (auto &key : expired) {
+    complete_pending_reply(key, REQUEST_STATUS_TIMEOUT, nullptr, 0);
+  }
+}
+
+void NibeGwComponent::send_status_reply(const socket_address &to, const request_key_type &key, status_reply_type type,
+                                        request_status_type status, const uint8_t *data, int len) {
+  int route = find_route(key);
+  if (route < 0 || !route_sockets_[route]) {
+    return;
+  }
+  auto &socket = route_sockets_[route];
+
+  auto &[address, token] = key;
+  request_data_type reply = {
+      STATUS_REPLY_START, type, status, (uint8_t) (address >> 8), (uint8_t) (address & 0xff), token,
+  };
+  reply.insert(reply.end(), data, data + len);
+
+  if (socket->sendto(reply.data(), reply.size(), 0, (sockaddr *) &to.storage, to.len) < 0) {
+    ESP_LOGW(TAG, "UDP sendto failed to %s, error: %d", to.str().c_str(), errno);
+  }
+}
+
+void NibeGwComponent::send_queue_reply(const socket_address &to, const request_key_type &key,
+                                       request_status_type status, uint8_t position, uint32_t now) {
+  uint32_t eta = token_eta(key, now, position == STATUS_REPLY_NO_POSITION ? 0 : position);
+  uint16_t eta_ms = std::min<uint32_t>(eta, STATUS_REPLY_NO_ETA);
+  uint8_t body[] = {position, (uint8_t) (eta_ms >> 8), (uint8_t) (eta_ms & 0xff)};
+  send_status_reply(to, key, STATUS_REPLY_QUEUED, status, body, sizeof(body));
+}
+
+bool NibeGwComponent::queue_full(const request_key_type &key) const {
+  const auto &queue = requests_.find(key);
+  if (queue == requests_.end()) {
+    return requests_.size() >= max_queues_;
+  }
+  return queue->second.size() >= requests_queue_max;
+}
+
+uint32_t NibeGwComponent::token_eta(const request_key_type &key, uint32_t now, uint8_t ahead) const {
+  const auto &it = schedule_.find(key);
+  if (it == schedule_.end()) {
+    return UINT32_MAX;
+  }
+  const auto &entry = it->second;
+  uint32_t since = now - entry.last;
+  if (entry.hits < schedule_hits_min_ || !entry.period || since > entry.period * 4) {
+    return UINT32_MAX;
+  }
+  return entry.period - since % entry.period + ahead * entry.period;
 }
 
 static int copy_request(const request_data_type &request, uint8_t *data) {
@@ -95,6 +736,85 @@ static int copy_request(const request_data_type &request, uint8_t *data) {
   return len;
 }
 
+static int copy_request(const frame_handle_type &frame, uint8_t *data) {
+  std::copy_n(frame.data(), frame.size(), data);
+  return frame.size();
+}
+
+void NibeGwComponent::add_queued_request(int address, int token, frame_handle_type frame, request_reply_type reply) {
+  request_key_type key(address, token);
+  if (requests_.size() >= max_queues_ && !requests_.count(key)) {
+    ESP_LOGW(TAG, "Queue limit of %u reached, dropped request to address: 0x%x token: 0x%x", (unsigned) max_queues_,
+             address, token);
+    memory_.reject(MEMORY_REQUESTS);
+    if (reply) {
+      reply(REQUEST_STATUS_DROPPED, nullptr, 0);
+    }
+    return;
+  }
+  auto &queue = requests_[key];
+  if (queue.size() >= requests_queue_max) {
+    auto dropped = queue.pop_front();
+    stats_.queue_dropped++;
+    if (dropped.reply) {
+      dropped.reply(REQUEST_STATUS_DROPPED, nullptr, 0);
+    }
+  }
+  queued_request_type request{std::move(frame), std::move(reply)};
+  request.queued = micros();
+  queue.push_back(std::move(request));
+}
+
+void NibeGwComponent::add_queued_request(int address, int token, const request_data_type &request,
+                                         request_reply_type reply) {
+  auto frame = pool_->acquire();
+  if (!frame) {
+    ESP_LOGW(TAG, "Frame pool exhausted, dropped request to address: 0x%x token: 0x%x", address, token);
+    if (reply) {
+      reply(REQUEST_STATUS_DROPPED, nullptr, 0);
+    }
+    return;
+  }
+  frame.resize(request.size());
+  std::copy_n(request.begin(), frame.size(), frame.data());
+  add_queued_request(address, token, std::move(frame), std::move(reply));
+}
+
+void NibeGwComponent::set_request(int address, int token, request_data_type request) {
+  set_request(address, token, [request](uint8_t *data) { return copy_request(request, data); });
+}
+
+void NibeGwComponent::set_request(int address, int token, request_provider_type provider) {
+  set_request(address, token, [provider](uint8_t *data) { return copy_request(provider(), data); });
+}
+
+void NibeGwComponent::write_register(uint16_t address, uint32_t value, request_reply_type reply) {
+  const uint8_t payload[] = {
+      (uint8_t) (address & 0xff), (uint8_t) (address >> 8), (uint8_t) (value & 0xff),
+      (uint8_t) (value >> 8),     (uint8_t) (value >> 16),  (uint8_t) (value >> 24),
+  };
+  auto frame = pool_->acquire();
+  if (!frame) {
+    ESP_LOGW(TAG, "Frame pool exhausted, dropped write to register %u", address);
+    if (reply) {
+      reply(REQUEST_STATUS_DROPPED, nullptr, 0);
+    }
+    return;
+  }
+  frame.resize(build_request_data(WRITE_TOKEN, payload, sizeof(payload), frame.data()));
+
+  /* an accepted write is the new value of the register, no need to wait for the next read */
+  add_queued_request(MODBUS40, WRITE_TOKEN, std::move(frame),
+                     [this, address, value, reply](request_status_type status, const uint8_t *data, int len) {
+                       if (status == REQUEST_STATUS_OK && registers_) {
+                         registers_->update(address, value);
+                       }
+                       if (reply) {
+                         reply(status, data, len);
+                       }
+                     });
+}
+
 int NibeGwComponent::callback_msg_token_received(uint16_t address, uint8_t command, uint8_t *data) {
   request_key_type key{address, command};
 
@@ -103,8 +823,29 @@ int NibeGwComponent::callback_msg_token_received(uint16_t address, uint8_t comma
     if (it != requests_.end()) {
       auto &queue = it->second;
       if (!queue.empty()) {
-        auto len = copy_request(queue.front(), data);
-        queue.pop();
+        /* a previous request for the token that is still unanswered never will be, its reply may send on the
+         * network or retry, so it is completed from loop() instead of inside the response window */
+        const auto &pending = pending_replies_.find(key);
+        if (pending != pending_replies_.end()) {
+          superseded_replies_.push_back(std::move(pending->second));
+          pending_replies_.erase(pending);
+        }
+
+        auto request = queue.pop_front();
+        auto len = copy_request(request.frame, data);
+        stats_.sent++;
+        if (!request.attempts) {
+          uint32_t latency = micros() - request.queued;
+          stats_.latency_avg = (stats_.latency_avg * 7 + latency) / 8;
+          stats_.latency_max = std::max(stats_.latency_max, latency);
+        }
+        if (request.reply) {
+          uint32_t now = millis();
+          if (!request.attempts++) {
+            request.first_sent = now;
+          }
+          pending_replies_[key] = {key, std::move(request), now, false};
+        }
         ESP_LOGD(TAG, "Response to address: 0x%x token: 0x%x bytes: %d", std::get<0>(key), std::get<1>(key), len);
         return len;
       }
@@ -112,32 +853,166 @@ int NibeGwComponent::callback_msg_token_received(uint16_t address, uint8_t comma
   }
 
   {
-    const auto &it = requests_provider_.find(key);
-    if (it != requests_provider_.end()) {
-      auto len = copy_request(it->second(), data);
+    auto len = write_provided_request(key, data);
+    if (len > 0) {
       ESP_LOGD(TAG, "Response to address: 0x%x token: 0x%x bytes: %d", std::get<0>(key), std::get<1>(key), len);
       return len;
     }
   }
 
+  if (auto *constant = find_constant(key)) {
+    std::copy_n(&constant_frames_[constant->offset], constant->len, data);
+    ESP_LOGD(TAG, "Constant response to address: 0x%x token: 0x%x bytes: %d", std::get<0>(key), std::get<1>(key),
+             constant->len);
+    return constant->len;
+  }
+
   return 0;
 }
 
 void NibeGwComponent::setup() {
   ESP_LOGI(TAG, "Starting up");
-  gw_->connect();
+  if (!pool_) {
+    pool_ = std::make_unique<NibeGwFramePool>(FRAME_POOL_DEFAULT);
+  }
+  /* normally at most one per token window between two loop() calls */
+  superseded_replies_.reserve(4);
+
+  if (tcp_) {
+    tcp_->set_request_handler(std::bind(&NibeGwComponent::recv_tcp_request, this, std::placeholders::_1,
+                                        std::placeholders::_2, std::placeholders::_3, std::placeholders::_4,
+                                        std::placeholders::_5, std::placeholders::_6, std::placeholders::_7));
+    /* tcp requests go to the same queues as udp ones, so the source policies apply to them as well */
+    tcp_->set_accept_handler([this](const socket_address &peer) {
+      if (udp_sources_.empty() || find_source(peer)) {
+        return true;
+      }
+      stats_.rejected_source++;
+      return false;
+    });
+  }
+
+  buses_[0].parent = this->parent_;
+  for (auto &[id, bus] : buses_) {
+    /* start + 8 data + stop bits per character, at the baud rate of each bus */
+    uint32_t timeout = inter_byte_timeout_;
+    if (!timeout) {
+      timeout = INTER_BYTE_TIMEOUT_CHARS * 10 * 1000000 / bus.parent->get_baud_rate();
+    }
+    bus.gw->setInterByteTimeout(timeout);
+  }
+  if (response_deadline_) {
+    deferred_frames_.reset(new deferred_frame_type[deferred_frames_max_]);
+  }
+
+  if (registers_) {
+    registers_->setup();
+  }
+
+#ifdef USE_HOST
+  if (shared_ring_ && !shared_ring_->open()) {
+    shared_ring_.reset();
+  }
+#endif
+
+  /* only asked when no client request is queued for the token, due polls go before the background scan */
+  if (poller_) {
+    poller_->setup();
+    add_request(MODBUS40, READ_TOKEN, [this](uint8_t *data) { return poller_->write_next_request(data); });
+  }
+  if (scanner_) {
+    scanner_->setup();
+    add_request(MODBUS40, READ_TOKEN, [this](uint8_t *data) { return scanner_->write_next_request(data); });
+  }
+
+  if (aggregator_) {
+    aggregator_->setup();
+  }
+
+  if (rules_) {
+    rules_->setup();
+  }
+
+  for (auto &[id, bus] : buses_) {
+    bus.gw->connect();
+  }
+}
+
+void NibeGwComponent::on_shutdown() {
+  if (registers_) {
+    registers_->save_snapshot();
+  }
 }
 
 void NibeGwComponent::dump_config() {
   ESP_LOGCONFIG(TAG, "NibeGw");
-  for (auto &&[address, timeout] : udp_targets_) {
-    ESP_LOGCONFIG(TAG, " Target: %s", address.str().c_str());
+  if (inter_byte_timeout_) {
+    ESP_LOGCONFIG(TAG, " Inter-byte timeout: %u us", (unsigned) inter_byte_timeout_);
+  }
+  for (auto &[id, bus] : buses_) {
+    ESP_LOGCONFIG(TAG, " Bus %u: %u baud, %u cycles", id, (unsigned) (bus.parent ? bus.parent->get_baud_rate() : 0),
+                  (unsigned) bus.gw->getCycleCount());
+  }
+  if (response_deadline_) {
+    ESP_LOGCONFIG(TAG,
+                  " Load shedding: deadline %u us, min slack %u us, slack %d us (min %d us), shed %u times, "
+                  "%u deferred frames dropped",
+                  (unsigned) response_deadline_, (unsigned) min_slack_, slack_, slack_min_, (unsigned) shed_count_,
+                  (unsigned) deferred_dropped_);
+  }
+  for (auto &target : udp_targets_) {
+    ESP_LOGCONFIG(TAG, " Target: %s%s%s", target.endpoint.str().c_str(), target.permanent ? "" : " (learned)",
+                  target.envelope ? " (envelope)" : "");
+  }
+  for (auto &source : udp_sources_) {
+    ESP_LOGCONFIG(TAG, " Source: %u.%u.%u.%u/%u Rate: %u/s Burst: %u Accepted: %u Limited: %u",
+                  (unsigned) (source.network >> 24), (unsigned) (source.network >> 16) & 0xff,
+                  (unsigned) (source.network >> 8) & 0xff, (unsigned) source.network & 0xff, source.prefix,
+                  source.rate, source.burst, (unsigned) source.accepted, (unsigned) source.limited);
+  }
+  for (size_t i = 0; i < routes_count_; i++) {
+    ESP_LOGCONFIG(TAG, " Handler %x:%x Port: %d", routes_[i].address, routes_[i].token, routes_[i].port);
+  }
+  for (size_t i = 0; i < constants_count_; i++) {
+    ESP_LOGCONFIG(TAG, " Constant %x:%x Bytes: %u", constants_[i].address, constants_[i].token, constants_[i].len);
   }
-  for (auto &&address : udp_sources_) {
-    ESP_LOGCONFIG(TAG, " Source: %s", address.str().c_str());
+  for (auto const &[key, entry] : schedule_) {
+    ESP_LOGCONFIG(TAG, " Schedule %x:%x Period: %u ms Hits: %u", std::get<0>(key), std::get<1>(key),
+                  (unsigned) entry.period, entry.hits);
   }
-  for (auto const &x : requests_sockets_) {
-    ESP_LOGCONFIG(TAG, " Handler %x:%x Port: %d", std::get<0>(x.first), std::get<1>(x.first), x.second.port);
+  ESP_LOGCONFIG(TAG, " Frame pool: %zu/%zu in use, high water %zu, exhausted %u times", pool_->in_use(),
+                pool_->capacity(), pool_->high_water(), (unsigned) pool_->exhausted());
+  if (stats_interval_) {
+    ESP_LOGCONFIG(TAG, " Stats interval: %u ms", (unsigned) stats_interval_);
+  }
+  ESP_LOGCONFIG(TAG, " Caps: %u targets, %u queues", (unsigned) max_targets_, (unsigned) max_queues_);
+  update_memory();
+  memory_.dump_config();
+  if (tcp_) {
+    tcp_->dump_config();
+  }
+#ifdef USE_HOST
+  if (shared_ring_) {
+    shared_ring_->dump_config();
+  }
+#endif
+  if (rmu_) {
+    rmu_->dump_config();
+  }
+  if (registers_) {
+    registers_->dump_config();
+  }
+  if (poller_) {
+    poller_->dump_config();
+  }
+  if (aggregator_) {
+    aggregator_->dump_config();
+  }
+  if (rules_) {
+    rules_->dump_config();
+  }
+  if (scanner_) {
+    scanner_->dump_config();
   }
 }
 
@@ -162,29 +1037,68 @@ std::unique_ptr<socket::Socket> NibeGwComponent::bind_local_socket(int port) {
   return fd;
 }
 
-void NibeGwComponent::run_request_socket(const request_key_type &key, request_socket_type &data) {
+void NibeGwComponent::run_request_socket(const route_type &route, std::unique_ptr<socket::Socket> &socket) {
   if (!is_connected_) {
-    if (data.socket) {
-      ESP_LOGI(TAG, "UDP socket released for port %d", data.port);
-      data.socket.reset();
+    if (socket) {
+      ESP_LOGI(TAG, "UDP socket released for port %d", route.port);
+      socket.reset();
     }
     return;
   }
 
-  if (!data.socket) {
-    data.socket = bind_local_socket(data.port);
+  if (!socket) {
+    socket = bind_local_socket(route.port);
   }
 
-  if (!data.socket) {
+  if (!socket) {
     return;
   }
 
-  if (!data.socket->ready()) {
+  if (!socket->ready()) {
     return;
   }
 
-  auto &[address, token] = key;
-  recv_local_socket(data.socket, address, token);
+  recv_local_socket(socket, route.address, route.token);
+}
+
+void NibeGwComponent::set_routes(const route_type *routes, size_t count) {
+  routes_ = routes;
+  routes_count_ = count;
+  route_sockets_ = std::make_unique<std::unique_ptr<socket::Socket>[]>(count);
+  read_route_ = find_route(request_key_type(MODBUS40, READ_TOKEN));
+}
+
+static bool key_less(uint16_t address, uint8_t token, const request_key_type &key) {
+  return address < std::get<0>(key) || (address == std::get<0>(key) && token < std::get<1>(key));
+}
+
+int NibeGwComponent::find_route(const request_key_type &key) const {
+  auto end = routes_ + routes_count_;
+  auto it = std::lower_bound(routes_, end, key, [](const route_type &route, const request_key_type &key) {
+    return key_less(route.address, route.token, key);
+  });
+  if (it == end || it->address != std::get<0>(key) || it->token != std::get<1>(key)) {
+    return -1;
+  }
+  return it - routes_;
+}
+
+const constant_route_type *NibeGwComponent::find_constant(const request_key_type &key) const {
+  auto end = constants_ + constants_count_;
+  auto it = std::lower_bound(constants_, end, key, [](const constant_route_type &route, const request_key_type &key) {
+    return key_less(route.address, route.token, key);
+  });
+  if (it == end || it->address != std::get<0>(key) || it->token != std::get<1>(key)) {
+    return nullptr;
+  }
+  return it;
+}
+
+socket::Socket *NibeGwComponent::read_socket() {
+  if (read_route_ < 0) {
+    return nullptr;
+  }
+  return route_sockets_[read_route_].get();
 }
 
 void NibeGwComponent::loop() {
@@ -204,26 +1118,74 @@ void NibeGwComponent::loop() {
 
   uint32_t now = millis();
 
-  // Static targets are always active
-  for (auto &target : udp_targets_static_) {
-    udp_targets_[target] = now;
+  // Check for timeouts on learned targets
+  expire_udp_targets(now);
+
+  if (registers_) {
+    registers_->loop();
+  }
+
+  if (poller_) {
+    poller_->loop();
+  }
+
+  if (aggregator_) {
+    aggregator_->loop();
+  }
+
+#ifdef USE_HOST
+  if (shared_ring_) {
+    shared_ring_->loop(now);
+  }
+#endif
+
+  // Drop replies the pump never answered
+  expire_pending_replies(now);
+
+  update_load_shedding(now);
+
+  if (!shedding_ && now - memory_last_ >= 1000) {
+    memory_last_ = now;
+    update_memory();
   }
 
-  // Check for timeouts on targets
-  std::erase_if(udp_targets_, [&](const auto &item) { return now - item.second > target_timeout_ms_; });
+  if (stats_interval_ && !shedding_ && now - stats_last_ >= stats_interval_) {
+    stats_last_ = now;
+    log_stats();
+  }
+
+  // While shedding, leave the loop to the buses as long as a frame is in flight
+  bool bus_busy = std::any_of(buses_.begin(), buses_.end(),
+                              [](const auto &item) { return item.second.gw->messageStillOnProgress(); });
+  if (!shedding_ || !bus_busy) {
+    // Poll sockets for incoming packets
+    for (size_t i = 0; i < routes_count_; i++) {
+      run_request_socket(routes_[i], route_sockets_[i]);
+    }
+
+    if (tcp_) {
+      if (is_connected_) {
+        tcp_->start();
+        tcp_->loop();
+      } else {
+        tcp_->stop();
+      }
+    }
+  }
 
-  // Poll sockets for incoming packets
-  for (auto &[key, data] : requests_sockets_) {
-    run_request_socket(key, data);
+  if (!shedding_ && !bus_busy) {
+    flush_deferred_frames();
   }
 
-  // Handle high frequency loop requirement
-  if (gw_->messageStillOnProgress()) {
+  // Handle high frequency loop requirement, ahead of expected tokens and while a frame is in flight
+  if (run_schedule(now) || bus_busy) {
     high_freq_.start();
   } else {
     high_freq_.stop();
   }
-  gw_->loop();
+  for (auto &[id, bus] : buses_) {
+    bus.gw->loop();
+  }
 }
 
 }  // namespace nibegw
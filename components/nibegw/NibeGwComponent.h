@@ -1,8 +1,10 @@
 #pragma once
 
+#include <array>
 #include <set>
-#include <queue>
+#include <deque>
 #include <vector>
+#include <cstring>
 #include <cstddef>
 #include <cstdint>
 #include <map>
@@ -17,7 +19,18 @@
 #include "esphome/components/socket/socket.h"
 
 #include "NibeGw.h"
+#include "NibeGwCodec.h"
+#include "NibeGwRegisters.h"
+#include "NibeGwRmu.h"
+#include "NibeGwScanner.h"
+#include "NibeGwPoller.h"
+#include "NibeGwAggregator.h"
+#include "NibeGwRules.h"
 #include "NibeGwSockAddress.h"
+#include "NibeGwTcpServer.h"
+#include "NibeGwPool.h"
+#include "NibeGwSharedRing.h"
+#include "NibeGwMemory.h"
 
 namespace esphome {
 namespace nibegw {
@@ -25,13 +38,167 @@ namespace nibegw {
 using namespace std;
 
 typedef std::tuple<uint16_t, uint8_t> request_key_type;
-typedef std::vector<uint8_t> request_data_type;
 typedef std::function<request_data_type(void)> request_provider_type;
+// Writes a response of at most MAX_DATA_LEN bytes directly into the bus buffer, returning its length.
+typedef std::function<int(uint8_t *data)> request_writer_type;
 typedef std::function<void(const request_data_type &)> message_listener_type;
 
-struct request_socket_type {
-  int port;
-  std::unique_ptr<socket::Socket> socket;
+enum request_status_type : uint8_t {
+  REQUEST_STATUS_OK = 0,
+  REQUEST_STATUS_DROPPED = 1,
+  REQUEST_STATUS_TIMEOUT = 2,
+  REQUEST_STATUS_INVALID = 3,
+  REQUEST_STATUS_NAK = 4,
+  REQUEST_STATUS_FAILED = 5,
+};
+
+// Called once with the final outcome of a queued request, after any retries.
+// On success data holds the frame the pump answered the request with.
+typedef std::function<void(request_status_type status, const uint8_t *data, int len)> request_reply_type;
+
+struct queued_request_type {
+  frame_handle_type frame;
+  request_reply_type reply;
+  uint32_t first_sent = 0;
+  uint8_t attempts = 0;
+  uint32_t queued = 0; /* micros() when queued */
+};
+
+// Status datagram sent back to the udp source of a request when
+// status_replies is enabled:
+// +----+------+--------+---------+---------+-------+---------+
+// | FE | TYPE | STATUS | ADDR_HI | ADDR_LO | TOKEN | BODY... |
+// +----+------+--------+---------+---------+-------+---------+
+// A completion carries the frame the pump answered with, if any. A queue
+// reply is sent as soon as a request is read and carries POS(1) ETA(2):
+// the number of requests ahead of it, 0xFF when it was not queued, and the
+// big endian ms until the token that would carry it, for a rejected request
+// until the next token frees a slot, 0xFFFF when no polling cycle is known.
+static const uint8_t STATUS_REPLY_START = 0xFE;
+
+enum status_reply_type : uint8_t {
+  STATUS_REPLY_COMPLETED = 0x01,
+  STATUS_REPLY_QUEUED = 0x02,
+};
+
+static const uint8_t STATUS_REPLY_NO_POSITION = 0xFF;
+static const uint16_t STATUS_REPLY_NO_ETA = 0xFFFF;
+
+// Envelope around the frames sent to udp targets that enabled it:
+// +----+-----+--------+----------+-------------+-----+---------+----------+
+// | FC | VER | SEQ(4) | FIRST(4) | COMPLETE(4) | BUS | OUTCOME | FRAME... |
+// +----+-----+--------+----------+-------------+-----+---------+----------+
+// Integers are big endian, FIRST and COMPLETE are micros() of the first
+// byte of the frame and of its completion on the bus.
+static const uint8_t ENVELOPE_START = 0xFC;
+static const uint8_t ENVELOPE_VERSION = 0x01;
+static const size_t ENVELOPE_HEADER_LEN = 16;
+
+enum envelope_outcome_type : uint8_t {
+  ENVELOPE_OUTCOME_NONE = 0,
+  ENVELOPE_OUTCOME_ACK = 1,
+  ENVELOPE_OUTCOME_NAK = 2,
+};
+
+// Learned polling cycle of one address/token pair.
+struct schedule_type {
+  uint32_t last = 0;   /* millis() of last observed token */
+  uint32_t period = 0; /* smoothed interval between tokens */
+  uint8_t hits = 0;    /* consecutive intervals matching the period */
+};
+
+// A transmitted request waiting for the pump to ack and answer it.
+struct pending_reply_type {
+  request_key_type key;
+  queued_request_type request;
+  uint32_t timestamp; /* millis() of last transmission */
+  bool acked;
+};
+
+// An RS-485 bus driven by the gateway, bus 0 is the uart of the component itself.
+struct bus_type {
+  NibeGw *gw;
+  uart::UARTComponent *parent;
+  uint32_t shed_cycle = 0; /* last cycle seen by load shedding */
+};
+
+// Counters of the network side, logged every stats interval. Counts are
+// totals since boot, maxima restart with each log line.
+struct stats_type {
+  uint32_t received = 0;         /* udp and tcp requests read */
+  uint32_t accepted = 0;         /* requests placed in a queue */
+  uint32_t rejected_source = 0;  /* udp requests from a source not allowed */
+  uint32_t rejected_rate = 0;    /* udp requests over the rate of their source */
+  uint32_t rejected_invalid = 0; /* requests that are not a valid slave frame */
+  uint32_t rejected_pool = 0;    /* requests arriving with the frame pool empty */
+  uint32_t rejected_full = 0;    /* udp requests refused by a full queue */
+  uint32_t queue_dropped = 0;    /* queued requests pushed out by newer ones */
+  uint32_t sent = 0;             /* queued requests sent on a token */
+  uint32_t latency_avg = 0;      /* smoothed us from queueing to first send */
+  uint32_t latency_max = 0;
+  uint32_t frames = 0;         /* bus frames sent to udp targets */
+  uint32_t fanout_avg = 0;     /* smoothed us per udp target and frame */
+  uint32_t fanout_max = 0;     /* longest us for sending one frame to all targets */
+  uint8_t fanout_targets = 0;  /* targets of the last frame */
+};
+
+// A udp target receiving the bus frames. Learned targets expire after a
+// timeout without requests, configured ones are permanent.
+struct target_type {
+  socket_endpoint endpoint;
+  uint32_t expires; /* millis() */
+  bool permanent;
+  bool envelope; /* frames are sent wrapped in an envelope */
+};
+
+// Udp source allowed to send requests, an IPv4 prefix with its own token
+// bucket. Tokens are counted in thousandths of a request.
+struct source_policy_type {
+  uint32_t network = 0; /* host byte order, masked to the prefix */
+  uint32_t mask = 0;
+  uint8_t prefix = 32;
+  uint16_t rate = 0; /* requests per second, 0 for no limit */
+  uint16_t burst = 0;
+  uint32_t tokens = 0;
+  uint32_t refilled = 0; /* millis() of last refill */
+  uint32_t accepted = 0;
+  uint32_t limited = 0;
+
+  bool matches(uint32_t address) const {
+    return (address & mask) == network;
+  }
+
+  bool take(uint32_t now) {
+    if (!rate) {
+      return true;
+    }
+    /* a bucket is full after at most 1000 s, longer idle times add nothing */
+    uint32_t elapsed = std::min<uint32_t>(now - refilled, 1000000);
+    refilled = now;
+    tokens = std::min<uint32_t>(tokens + elapsed * rate, burst * 1000);
+    if (tokens < 1000) {
+      return false;
+    }
+    tokens -= 1000;
+    return true;
+  }
+};
+
+// Udp port feeding the request queue of an address/token pair. Generated
+// at build time, sorted by address and token.
+struct route_type {
+  uint16_t address;
+  uint8_t token;
+  uint16_t port;
+};
+
+// Constant response to an address/token pair, stored at offset in the
+// generated frame table. Generated sorted by address and token.
+struct constant_route_type {
+  uint16_t address;
+  uint8_t token;
+  uint8_t len;
+  uint16_t offset;
 };
 
 class NibeGwComponent : public esphome::Component, public esphome::uart::UARTDevice {
@@ -39,77 +206,309 @@ class NibeGwComponent : public esphome::Component, public esphome::uart::UARTDev
     return setup_priority::PROCESSOR;
   }
   const char *TAG = "nibegw";
-  const int requests_queue_max = 3;
+  static constexpr size_t requests_queue_max = 3;
   const uint32_t target_timeout_ms_ = 120000;
+  const uint32_t reply_timeout_ms_ = 2000;
+  const uint32_t schedule_lead_ms_ = 20;
+  const uint32_t schedule_tolerance_ms_ = 20;
+  const uint8_t schedule_hits_min_ = 3;
   bool is_connected_ = false;
+  uint32_t inter_byte_timeout_ = 0;
+  uint32_t retry_budget_ms_ = 5000;
+  bool status_replies_ = false;
+  bool envelope_ = false; /* default for learned targets */
+  uint32_t envelope_seq_ = 0;
+  size_t envelope_targets_ = 0; /* the envelope is only built while some target wants it */
+  uint32_t stats_interval_ = 0;
+  uint32_t stats_last_ = 0;
+  stats_type stats_;
+  NibeGwMemory memory_;
+  uint32_t memory_last_ = 0;
+  size_t max_targets_ = 32;
+  size_t max_queues_ = 64;
+
+  // Load shedding, a response deadline of 0 disables it
+  struct deferred_frame_type {
+    uint16_t len; /* of the frame, without the envelope */
+    uint8_t data[ENVELOPE_HEADER_LEN + MAX_DATA_LEN * 2]; /* envelope, then a frame with our response if any */
+  };
+  static const size_t deferred_frames_max_ = 16;
+  uint32_t response_deadline_ = 0;
+  uint32_t min_slack_ = 0;
+  uint32_t shed_hold_ms_ = 1000;
+  bool shedding_ = false;
+  uint32_t shed_until_ = 0;
+  uint32_t shed_count_ = 0;
+  uint32_t shed_dropped_ = 0;     /* deferred frames dropped in the current episode */
+  uint32_t deferred_dropped_ = 0; /* deferred frames dropped since boot */
+  int32_t slack_ = 0;
+  int32_t slack_min_ = INT32_MAX;
+  /* fixed ring of frames held back while shedding, allocated once in setup */
+  std::unique_ptr<deferred_frame_type[]> deferred_frames_;
+  size_t deferred_head_ = 0;
+  size_t deferred_count_ = 0;
 
-  std::vector<socket_address> udp_sources_;
-  std::vector<socket_address> udp_targets_static_;
-  std::map<socket_address, uint32_t> udp_targets_;
-  std::map<request_key_type, std::queue<request_data_type>> requests_;
-  std::map<request_key_type, request_provider_type> requests_provider_;
-  std::map<request_key_type, request_socket_type> requests_sockets_;
+  std::vector<source_policy_type> udp_sources_; /* longest prefix first */
+  /* sorted by endpoint */
+  std::vector<target_type> udp_targets_;
+  /* timer wheel of learned targets, each slot holds the targets due in one tick */
+  static constexpr uint32_t target_wheel_tick_ms_ = 4000;
+  static constexpr size_t target_wheel_slots_ = 32;
+  std::array<std::vector<socket_endpoint>, target_wheel_slots_> target_wheel_;
+  uint32_t target_wheel_tick_ = 0;
+  std::unique_ptr<NibeGwFramePool> pool_;
+  /* one spare slot, so the single outstanding request of an address can be put back for a retry */
+  std::map<request_key_type, NibeGwRing<queued_request_type, requests_queue_max + 1>> requests_;
+  std::map<request_key_type, pending_reply_type> pending_replies_;
+  std::vector<pending_reply_type> superseded_replies_; /* timed out in a token window, completed from loop() */
+  std::map<request_key_type, schedule_type> schedule_;
+  std::map<request_key_type, std::vector<request_writer_type>> requests_provider_;
+  const route_type *routes_ = nullptr;
+  size_t routes_count_ = 0;
+  std::unique_ptr<std::unique_ptr<socket::Socket>[]> route_sockets_;
+  int read_route_ = -1; /* route of the modbus read port, which also sends the frames */
+  const constant_route_type *constants_ = nullptr;
+  size_t constants_count_ = 0;
+  const uint8_t *constant_frames_ = nullptr;
   std::map<request_key_type, message_listener_type> message_listener_;
+  std::unique_ptr<NibeGwTcpServer> tcp_;
+#ifdef USE_HOST
+  std::unique_ptr<NibeGwSharedRing> shared_ring_;
+#endif
+  std::unique_ptr<NibeGwRmu> rmu_;
+  std::unique_ptr<NibeGwRegisters> registers_;
+  std::unique_ptr<NibeGwScanner> scanner_;
+  std::unique_ptr<NibeGwPoller> poller_;
+  std::unique_ptr<NibeGwAggregator> aggregator_;
+  std::unique_ptr<NibeGwRules> rules_;
   HighFrequencyLoopRequester high_freq_;
 
   NibeGw *gw_;
+  std::map<uint8_t, bus_type> buses_;
 
-  void callback_msg_received(const uint8_t *data, int len);
+  void callback_msg_received(NibeGw *gw, const uint8_t *data, int len);
   int callback_msg_token_received(uint16_t address, uint8_t command, uint8_t *data);
   void callback_debug(uint8_t verbose, char *data);
 
-  void run_request_socket(const request_key_type &key, request_socket_type &data);
+  void run_request_socket(const route_type &route, std::unique_ptr<socket::Socket> &socket);
+  int find_route(const request_key_type &key) const;
+  const constant_route_type *find_constant(const request_key_type &key) const;
+  socket::Socket *read_socket();
+  source_policy_type *find_source(const socket_address &from);
+  void add_udp_target(const socket_endpoint &endpoint, uint32_t now, bool permanent, bool envelope);
+  void arm_udp_target(const target_type &target);
+  void expire_udp_targets(uint32_t now);
+  void create_registers(int capacity);
   void recv_local_socket(std::unique_ptr<socket::Socket> &fd, int address, int token);
+  void recv_tcp_request(uint32_t client, const socket_address &peer, uint16_t seq, uint16_t address, uint8_t token,
+                        const uint8_t *data, size_t len);
+  void handle_pending_reply(const uint8_t *data, int len);
+  void complete_pending_reply(const request_key_type &key, request_status_type status, const uint8_t *data, int len);
+  void finish_request(const request_key_type &key, queued_request_type request, request_status_type status,
+                      const uint8_t *data, int len);
+  void send_status_reply(const socket_address &to, const request_key_type &key, status_reply_type type,
+                         request_status_type status, const uint8_t *data, int len);
+  void send_queue_reply(const socket_address &to, const request_key_type &key, request_status_type status,
+                        uint8_t position, uint32_t now);
+  bool queue_full(const request_key_type &key) const;
+  uint32_t token_eta(const request_key_type &key, uint32_t now, uint8_t ahead = 0) const;
+  void write_envelope(NibeGw *gw, uint8_t *header);
+  // packet is the envelope followed by data, null while no target wants an envelope.
+  void send_frame(const uint8_t *packet, const uint8_t *data, size_t len);
+  void update_load_shedding(uint32_t now);
+  void defer_frame(NibeGw *gw, const uint8_t *data, int len);
+  void learn_schedule(const request_key_type &key, uint32_t now);
+  bool run_schedule(uint32_t now);
+  int write_provided_request(const request_key_type &key, uint8_t *data);
+  void flush_deferred_frames();
+  void log_stats();
+  void update_memory();
+  void expire_pending_replies(uint32_t now);
 
   std::unique_ptr<socket::Socket> bind_local_socket(int port);
 
  public:
-  void add_target(const network::IPAddress &ip, int port) {
-    udp_targets_static_.push_back(socket_address(ip, port));
+  void add_target(const network::IPAddress &ip, int port, bool envelope = false) {
+    add_udp_target(socket_endpoint(socket_address(ip, port)), 0, true, envelope);
   }
 
-  void add_source_ip(const network::IPAddress &ip) {
-    udp_sources_.push_back(socket_address(ip, 0));
-  };
+  // Allow requests from an IPv4 prefix, at most rate per second with bursts of burst requests.
+  void add_source(const network::IPAddress &ip, uint8_t prefix, uint16_t rate, uint16_t burst);
 
-  void add_socket_request(int address, int token, int port) {
-    auto &handler = requests_sockets_[request_key_type(address, token)];
-    handler.port = port;
+  void set_routes(const route_type *routes, size_t count);
+  void set_constants(const constant_route_type *constants, size_t count, const uint8_t *frames) {
+    constants_ = constants;
+    constants_count_ = count;
+    constant_frames_ = frames;
   }
 
-  void set_request(int address, int token, request_data_type request) {
-    set_request(address, token, [request] { return request; });
+  void set_request(int address, int token, request_data_type request);
+  void set_request(int address, int token, request_provider_type provider);
+
+  void set_request(int address, int token, request_writer_type writer) {
+    auto &writers = requests_provider_[request_key_type(address, token)];
+    writers.clear();
+    writers.push_back(std::move(writer));
   }
 
-  void set_request(int address, int token, request_provider_type provider) {
-    requests_provider_[request_key_type(address, token)] = provider;
+  // Append a writer asked when the ones added before it have nothing to send.
+  void add_request(int address, int token, request_writer_type writer) {
+    requests_provider_[request_key_type(address, token)].push_back(std::move(writer));
   }
 
   void add_listener(int address, int token, message_listener_type listener) {
     message_listener_[request_key_type(address, token)] = listener;
   }
 
-  void add_queued_request(int address, int token, request_data_type request) {
-    auto &queue = requests_[request_key_type(address, token)];
-    if (queue.size() >= requests_queue_max) {
-      queue.pop();
-    }
-    queue.push(std::move(request));
+  void set_inter_byte_timeout(uint32_t timeout) {
+    inter_byte_timeout_ = timeout;
+  }
+
+  void set_retry_budget(uint32_t budget) {
+    retry_budget_ms_ = budget;
+  }
+
+  void set_status_replies(bool enabled) {
+    status_replies_ = enabled;
+  }
+
+  // Send frames to learned targets wrapped in an envelope.
+  void set_envelope(bool enabled) {
+    envelope_ = enabled;
+  }
+
+  void set_stats_interval(uint32_t interval) {
+    stats_interval_ = interval;
   }
 
-  void add_acknowledge(int address) {
-    gw_->setAcknowledge(address, true);
+  const stats_type &stats() const {
+    return stats_;
   }
 
+  // Hard caps on learned udp targets and on address/token request queues,
+  // further ones are refused instead of growing the heap.
+  void set_memory_caps(size_t max_targets, size_t max_queues) {
+    max_targets_ = max_targets;
+    max_queues_ = max_queues;
+  }
+
+  NibeGwMemory &memory() {
+    return memory_;
+  }
+
+  void set_load_shedding(uint32_t response_deadline, uint32_t min_slack, uint32_t hold) {
+    response_deadline_ = response_deadline;
+    min_slack_ = min_slack;
+    shed_hold_ms_ = hold;
+  }
+
+  // True while the bus response window is at risk, non critical work such as
+  // telemetry and state publishing should be postponed.
+  bool is_shedding() const {
+    return shedding_;
+  }
+
+  void set_tcp(int port, int max_clients, int buffer_size) {
+    tcp_ = std::make_unique<NibeGwTcpServer>(port, max_clients, buffer_size);
+  }
+
+#ifdef USE_HOST
+  void set_shared_ring(const std::string &path, uint32_t slots, uint32_t readers, uint32_t report_interval) {
+    shared_ring_ = std::make_unique<NibeGwSharedRing>(path, slots, readers);
+    shared_ring_->set_report_interval(report_interval);
+  }
+#endif
+
+  // Queue a request for the next token of address, dropping the oldest one when the queue is full.
+  void add_queued_request(int address, int token, frame_handle_type frame, request_reply_type reply = nullptr);
+  void add_queued_request(int address, int token, const request_data_type &request,
+                          request_reply_type reply = nullptr);
+
+  void set_frame_pool(size_t size) {
+    pool_ = std::make_unique<NibeGwFramePool>(size);
+  }
+
+  // Queue a write of a raw value to a MODBUS40 register.
+  void write_register(uint16_t address, uint32_t value, request_reply_type reply = nullptr);
+
+  // Drive another bus on its own uart, with addresses on it prefixed by the bus id in the high byte.
+  void add_bus(uint8_t bus, uart::UARTComponent *parent, esphome::GPIOPin *dir_pin);
+
+  void add_acknowledge(int address);
+  void set_acknowledge_mask(uint8_t bus, const uint8_t *mask);
+
   NibeGw &gw() {
     return *gw_;
   }
 
+  void set_registers(int capacity, uint32_t snapshot_interval) {
+    create_registers(capacity);
+    registers_->set_snapshot_interval(snapshot_interval);
+  }
+
+  NibeGwRegisters &registers() {
+    if (!registers_) {
+      create_registers(REGISTER_SNAPSHOT_MAX);
+    }
+    return *registers_;
+  }
+
+  void set_aggregate_window(uint32_t window) {
+    aggregator().set_window(window);
+  }
+
+  void add_aggregate_register(uint16_t address, register_type type) {
+    aggregator().add_register(address, type);
+  }
+
+  void add_aggregate_target(const network::IPAddress &ip, int port) {
+    aggregator().add_target(ip, port);
+  }
+
+  NibeGwAggregator &aggregator() {
+    if (!aggregator_) {
+      aggregator_ = std::make_unique<NibeGwAggregator>(this);
+    }
+    return *aggregator_;
+  }
+
+  // Send a datagram from the read port to a single target.
+  void send_datagram(const socket_address &to, const uint8_t *data, size_t len);
+
+  void add_rule(const rule_type &rule) {
+    if (!rules_) {
+      rules_ = std::make_unique<NibeGwRules>(this);
+    }
+    rules_->add_rule(rule);
+  }
+
+  void add_poll_register(uint16_t address, uint32_t period) {
+    if (!poller_) {
+      poller_ = std::make_unique<NibeGwPoller>(this);
+    }
+    poller_->add_register(address, period);
+  }
+
+  void add_scan_register(uint16_t address) {
+    if (!scanner_) {
+      scanner_ = std::make_unique<NibeGwScanner>(this);
+    }
+    scanner_->add_register(address);
+  }
+
+  NibeGwRmu &rmu() {
+    if (!rmu_) {
+      rmu_ = std::make_unique<NibeGwRmu>(this);
+    }
+    return *rmu_;
+  }
+
   NibeGwComponent(GPIOPin *dir_pin);
 
   void setup() override;
   void dump_config() override;
   void loop() override;
+  void on_shutdown() override;
 };
 
 }  // namespace nibegw
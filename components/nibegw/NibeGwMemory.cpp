@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <cmath>
+
+#include "esphome/core/log.h"
+
+#include "NibeGwMemory.h"
+
+#ifdef USE_ESP32
+#include <esp_heap_caps.h>
+#endif
+
+namespace esphome {
+namespace nibegw {
+
+static const char *TAG = "nibegw.memory";
+
+void NibeGwMemory::update(memory_structure_type structure, size_t count, size_t bytes) {
+  auto &usage = usage_[structure];
+  tracked_bytes_ = tracked_bytes_ - usage.bytes + bytes;
+  tracked_bytes_max_ = std::max(tracked_bytes_max_, tracked_bytes_);
+  usage.count = count;
+  usage.count_max = std::max(usage.count_max, usage.count);
+  usage.bytes = bytes;
+  usage.bytes_max = std::max(usage.bytes_max, usage.bytes);
+}
+
+void NibeGwMemory::sample_heap() {
+#ifdef USE_ESP32
+  frame_min_free_heap_ = std::min<uint32_t>(frame_min_free_heap_, heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+#endif
+}
+
+uint32_t NibeGwMemory::free_heap() const {
+#ifdef USE_ESP32
+  return heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+#else
+  return 0;
+#endif
+}
+
+uint32_t NibeGwMemory::min_free_heap() const {
+#ifdef USE_ESP32
+  return heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+#else
+  return 0;
+#endif
+}
+
+float NibeGwMemory::metric(memory_metric_type metric, memory_structure_type structure) const {
+  switch (metric) {
+#ifdef USE_ESP32
+    case MEMORY_METRIC_FREE_HEAP:
+      return free_heap();
+    case MEMORY_METRIC_MIN_FREE_HEAP:
+      return min_free_heap();
+    case MEMORY_METRIC_FRAME_MIN_FREE_HEAP:
+      return frame_min_free_heap_ == UINT32_MAX ? NAN : frame_min_free_heap_;
+#endif
+    case MEMORY_METRIC_TRACKED_BYTES:
+      return tracked_bytes_;
+    case MEMORY_METRIC_TRACKED_BYTES_MAX:
+      return tracked_bytes_max_;
+    case MEMORY_METRIC_COUNT:
+      return usage_[structure].count;
+    case MEMORY_METRIC_COUNT_MAX:
+      return usage_[structure].count_max;
+    default:
+      return NAN;
+  }
+}
+
+const char *NibeGwMemory::name(memory_structure_type structure) {
+  switch (structure) {
+    case MEMORY_REQUESTS:
+      return "requests";
+    case MEMORY_PROVIDERS:
+      return "providers";
+    case MEMORY_LISTENERS:
+      return "listeners";
+    case MEMORY_TARGETS:
+      return "targets";
+    case MEMORY_PENDING_REPLIES:
+      return "pending_replies";
+    case MEMORY_SCHEDULE:
+      return "schedule";
+    case MEMORY_DEFERRED_FRAMES:
+      return "deferred_frames";
+    case MEMORY_REGISTERS:
+      return "registers";
+    default:
+      return "unknown";
+  }
+}
+
+void NibeGwMemory::dump_config() {
+  ESP_LOGCONFIG(TAG, "NibeGw Memory");
+#ifdef USE_ESP32
+  ESP_LOGCONFIG(TAG, " Free heap: %u bytes, min %u bytes, min on frame path %u bytes", (unsigned) free_heap(),
+                (unsigned) min_free_heap(), (unsigned) (frame_min_free_heap_ == UINT32_MAX ? 0 : frame_min_free_heap_));
+#endif
+  ESP_LOGCONFIG(TAG, " Tracked: %u bytes, high water %u bytes", (unsigned) tracked_bytes_,
+                (unsigned) tracked_bytes_max_);
+  for (size_t i = 0; i < MEMORY_STRUCTURES; i++) {
+    const auto &usage = usage_[i];
+    ESP_LOGCONFIG(TAG, " %s: %u (max %u) entries, %u (max %u) bytes, %u rejected",
+                  name((memory_structure_type) i), (unsigned) usage.count, (unsigned) usage.count_max,
+                  (unsigned) usage.bytes, (unsigned) usage.bytes_max, (unsigned) usage.rejected);
+  }
+}
+
+}  // namespace nibegw
+}  // namespace esphome
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace nibegw {
+
+// Structures of the gateway that grow at runtime or with the configuration.
+enum memory_structure_type : uint8_t {
+  MEMORY_REQUESTS,
+  MEMORY_PROVIDERS,
+  MEMORY_LISTENERS,
+  MEMORY_TARGETS,
+  MEMORY_PENDING_REPLIES,
+  MEMORY_SCHEDULE,
+  MEMORY_DEFERRED_FRAMES,
+  MEMORY_REGISTERS,
+  MEMORY_STRUCTURES,
+};
+
+// Values published by metric sensors, counts refer to one structure.
+enum memory_metric_type : uint8_t {
+  MEMORY_METRIC_FREE_HEAP,
+  MEMORY_METRIC_MIN_FREE_HEAP,
+  MEMORY_METRIC_FRAME_MIN_FREE_HEAP,
+  MEMORY_METRIC_TRACKED_BYTES,
+  MEMORY_METRIC_TRACKED_BYTES_MAX,
+  MEMORY_METRIC_COUNT,
+  MEMORY_METRIC_COUNT_MAX,
+};
+
+struct memory_usage_type {
+  uint32_t count = 0;
+  uint32_t count_max = 0;
+  uint32_t bytes = 0;
+  uint32_t bytes_max = 0;
+  uint32_t rejected = 0; /* insertions refused by a cap */
+};
+
+// Rough heap cost of standard containers. A tree node carries three
+// pointers and a color next to its value, and std::function captures larger
+// than its small buffer are allocated separately and not accounted for.
+template<typename M> size_t map_bytes(const M &map) {
+  return map.size() * (sizeof(typename M::value_type) + 4 * sizeof(void *));
+}
+
+template<typename V> size_t vector_bytes(const V &vector) {
+  return vector.capacity() * sizeof(typename V::value_type);
+}
+
+// Current and high-water element counts and bytes of the gateway structures,
+// and heap snapshots taken on the frame path.
+class NibeGwMemory {
+ public:
+  void update(memory_structure_type structure, size_t count, size_t bytes);
+  void reject(memory_structure_type structure) {
+    usage_[structure].rejected++;
+  }
+  const memory_usage_type &usage(memory_structure_type structure) const {
+    return usage_[structure];
+  }
+
+  uint32_t tracked_bytes() const {
+    return tracked_bytes_;
+  }
+  uint32_t tracked_bytes_max() const {
+    return tracked_bytes_max_;
+  }
+
+  // Sample the free heap, cheap enough to call for every frame.
+  void sample_heap();
+  uint32_t free_heap() const;
+  uint32_t min_free_heap() const;
+  uint32_t frame_min_free_heap() const {
+    return frame_min_free_heap_;
+  }
+
+  // Value of a metric, NAN where the platform has no heap statistics.
+  float metric(memory_metric_type metric, memory_structure_type structure) const;
+
+  void dump_config();
+
+  static const char *name(memory_structure_type structure);
+
+ protected:
+  std::array<memory_usage_type, MEMORY_STRUCTURES> usage_;
+  uint32_t tracked_bytes_ = 0;
+  uint32_t tracked_bytes_max_ = 0;
+  uint32_t frame_min_free_heap_ = UINT32_MAX;
+};
+
+}  // namespace nibegw
+}  // namespace esphome
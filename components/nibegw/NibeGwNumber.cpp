@@ -0,0 +1,44 @@
+#include <cmath>
+
+#include "esphome/core/log.h"
+
+#include "NibeGwNumber.h"
+#include "NibeGwComponent.h"
+
+namespace esphome {
+namespace nibegw {
+
+static const char *TAG = "nibegw.number";
+
+void NibeGwNumber::setup() {
+  auto &registers = this->gw_->registers();
+  registers.add_listener(this->address_, [this](const register_entry_type &entry) { this->handle_register(entry); });
+  if (auto *entry = registers.find(this->address_)) {
+    this->handle_register(*entry);
+  }
+}
+
+void NibeGwNumber::handle_register(const register_entry_type &entry) {
+  float value = get_register_value(entry.value, this->type_) * this->factor_;
+  if (!std::isnan(value)) {
+    this->publish_state(value);
+  }
+}
+
+void NibeGwNumber::control(float value) {
+  uint32_t raw = set_register_value(value, this->factor_, this->type_);
+  ESP_LOGD(TAG, "'%s': writing %f -> 0x%08X", this->get_name().c_str(), value, (unsigned) raw);
+  this->gw_->write_register(this->address_, raw, [this](request_status_type status, const uint8_t *data, int len) {
+    if (status != REQUEST_STATUS_OK) {
+      ESP_LOGW(TAG, "'%s': write failed: %d", this->get_name().c_str(), status);
+    }
+  });
+}
+
+void NibeGwNumber::dump_config() {
+  LOG_NUMBER("", "NibeGw Register Number", this);
+  ESP_LOGCONFIG(TAG, "  Register: %u", this->address_);
+}
+
+}  // namespace nibegw
+}  // namespace esphome
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+#include "esphome/core/component.h"
+#include "esphome/components/number/number.h"
+
+#include "NibeGwCodec.h"
+#include "NibeGwRegisters.h"
+
+namespace esphome {
+namespace nibegw {
+
+class NibeGwComponent;
+
+// Exposes a pump register as a number, writes go straight to the MODBUS40 write queue.
+class NibeGwNumber : public number::Number, public Component {
+ public:
+  void setup() override;
+  void dump_config() override;
+  void set_gw(NibeGwComponent *gw) {
+    this->gw_ = gw;
+  }
+  void set_register(uint16_t address) {
+    this->address_ = address;
+  }
+  void set_type(register_type type) {
+    this->type_ = type;
+  }
+  void set_factor(float factor) {
+    this->factor_ = factor;
+  }
+
+ protected:
+  void control(float value) override;
+  void handle_register(const register_entry_type &entry);
+
+  NibeGwComponent *gw_{nullptr};
+  uint16_t address_;
+  register_type type_{REGISTER_TYPE_S16};
+  float factor_{1.0};
+};
+
+}  // namespace nibegw
+}  // namespace esphome
@@ -0,0 +1,94 @@
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include "NibeGwPoller.h"
+#include "NibeGwComponent.h"
+#include "NibeGw.h"
+
+namespace esphome {
+namespace nibegw {
+
+static const char *TAG = "nibegw.poller";
+
+static const uint32_t POLL_REPORT_INTERVAL = 60 * 1000;
+
+void NibeGwPoller::setup() {
+  auto &registers = gw_->registers();
+  uint32_t now = millis();
+  for (auto &entry : entries_) {
+    entry.deadline = now;
+    registers.add_listener(entry.address,
+                           [this, &entry](const register_entry_type &reg) { handle_register(entry, reg); });
+  }
+  report_time_ = now;
+}
+
+void NibeGwPoller::handle_register(poll_entry_type &entry, const register_entry_type &reg) {
+  if (reg.stale) {
+    return;
+  }
+  if (entry.updated) {
+    uint32_t interval = reg.timestamp - entry.updated;
+    entry.achieved = entry.achieved ? (entry.achieved * 7 + interval) / 8 : interval;
+  }
+  entry.updated = reg.timestamp;
+  entry.deadline = reg.timestamp + entry.period;
+}
+
+bool NibeGwPoller::is_behind(const poll_entry_type &entry) const {
+  /* allow some jitter from the token rate before calling it oversubscribed */
+  return entry.achieved > entry.period + entry.period / 2;
+}
+
+int NibeGwPoller::write_next_request(uint8_t *data) {
+  uint32_t now = millis();
+
+  poll_entry_type *best = nullptr;
+  for (auto &entry : entries_) {
+    if ((int32_t) (now - entry.deadline) < 0) {
+      continue;
+    }
+    if (!best || (int32_t) (entry.deadline - best->deadline) < 0) {
+      best = &entry;
+    }
+  }
+
+  if (!best) {
+    return 0;
+  }
+
+  /* retry after a period if no answer arrives, an answer moves the deadline again */
+  best->deadline = now + best->period;
+  best->requests++;
+
+  ESP_LOGV(TAG, "Polling register %u", best->address);
+  const uint8_t payload[] = {(uint8_t) (best->address & 0xff), (uint8_t) (best->address >> 8)};
+  return build_request_data(READ_TOKEN, payload, sizeof(payload), data);
+}
+
+void NibeGwPoller::loop() {
+  uint32_t now = millis();
+  if (now - report_time_ < POLL_REPORT_INTERVAL) {
+    return;
+  }
+  report_time_ = now;
+
+  for (auto &entry : entries_) {
+    if (is_behind(entry)) {
+      ESP_LOGW(TAG, "Bus oversubscribed, register %u refreshed every %u ms, requested %u ms", entry.address,
+               (unsigned) entry.achieved, (unsigned) entry.period);
+    }
+  }
+}
+
+void NibeGwPoller::dump_config() {
+  ESP_LOGCONFIG(TAG, " Polling %zu registers", entries_.size());
+  for (auto &entry : entries_) {
+    ESP_LOGCONFIG(TAG, "  Register: %u period: %u ms achieved: %u ms requests: %u%s", entry.address,
+                  (unsigned) entry.period, (unsigned) entry.achieved, (unsigned) entry.requests,
+                  is_behind(entry) ? " (behind)" : "");
+  }
+}
+
+}  // namespace nibegw
+}  // namespace esphome
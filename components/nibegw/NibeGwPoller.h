@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "NibeGwRegisters.h"
+
+namespace esphome {
+namespace nibegw {
+
+class NibeGwComponent;
+
+// Reads registers at configured periods in READ_TOKEN slots that no client
+// request claimed, earliest deadline first. Updates from any source, such as
+// the MODBUS40 telegram, push the deadline of a register forward.
+class NibeGwPoller {
+ public:
+  explicit NibeGwPoller(NibeGwComponent *gw) : gw_(gw) {}
+
+  void add_register(uint16_t address, uint32_t period) {
+    entries_.push_back({address, period});
+  }
+
+  void setup();
+  void loop();
+  void dump_config();
+
+  // Build a read request for the register with the earliest passed deadline, returns 0 if none is due.
+  int write_next_request(uint8_t *data);
+
+ protected:
+  struct poll_entry_type {
+    uint16_t address;
+    uint32_t period;        /* requested refresh period in ms */
+    uint32_t deadline = 0;  /* millis() when the next read is due */
+    uint32_t updated = 0;   /* millis() of last update */
+    uint32_t achieved = 0;  /* smoothed interval between updates in ms */
+    uint32_t requests = 0;
+  };
+
+  void handle_register(poll_entry_type &entry, const register_entry_type &reg);
+  bool is_behind(const poll_entry_type &entry) const;
+
+  NibeGwComponent *gw_;
+  std::vector<poll_entry_type> entries_;
+  uint32_t report_time_ = 0;
+};
+
+}  // namespace nibegw
+}  // namespace esphome
@@ -0,0 +1,52 @@
+#include <algorithm>
+
+#include "NibeGwPool.h"
+
+namespace esphome {
+namespace nibegw {
+
+uint8_t *frame_handle_type::data() {
+  return pool_->slots_[slot_].data;
+}
+
+const uint8_t *frame_handle_type::data() const {
+  return pool_->slots_[slot_].data;
+}
+
+size_t frame_handle_type::size() const {
+  return pool_->slots_[slot_].len;
+}
+
+void frame_handle_type::resize(size_t len) {
+  pool_->slots_[slot_].len = std::min(len, capacity());
+}
+
+void frame_handle_type::reset() {
+  if (pool_) {
+    pool_->release(slot_);
+    pool_ = nullptr;
+  }
+}
+
+NibeGwFramePool::NibeGwFramePool(size_t capacity)
+    : capacity_(std::min<size_t>(capacity, UINT8_MAX)), slots_(new slot_type[capacity_]) {
+  free_.reserve(capacity_);
+  for (size_t i = capacity_; i > 0; i--) {
+    free_.push_back(i - 1);
+  }
+}
+
+frame_handle_type NibeGwFramePool::acquire() {
+  if (free_.empty()) {
+    exhausted_++;
+    return {};
+  }
+  uint8_t slot = free_.back();
+  free_.pop_back();
+  slots_[slot].len = 0;
+  high_water_ = std::max(high_water_, in_use());
+  return {this, slot};
+}
+
+}  // namespace nibegw
+}  // namespace esphome
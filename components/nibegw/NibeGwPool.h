@@ -0,0 +1,154 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+#include "NibeGw.h"
+
+namespace esphome {
+namespace nibegw {
+
+class NibeGwFramePool;
+
+// Owning reference to one frame sized buffer of a pool, returned to the pool
+// when the handle is reset or destroyed.
+class frame_handle_type {
+ public:
+  frame_handle_type() = default;
+  frame_handle_type(const frame_handle_type &) = delete;
+  frame_handle_type &operator=(const frame_handle_type &) = delete;
+  frame_handle_type(frame_handle_type &&other) noexcept : pool_(other.pool_), slot_(other.slot_) {
+    other.pool_ = nullptr;
+  }
+  frame_handle_type &operator=(frame_handle_type &&other) noexcept {
+    if (this != &other) {
+      reset();
+      pool_ = other.pool_;
+      slot_ = other.slot_;
+      other.pool_ = nullptr;
+    }
+    return *this;
+  }
+  ~frame_handle_type() {
+    reset();
+  }
+
+  explicit operator bool() const {
+    return pool_ != nullptr;
+  }
+
+  uint8_t *data();
+  const uint8_t *data() const;
+  size_t size() const;
+  void resize(size_t len);
+  void reset();
+
+  static constexpr size_t capacity() {
+    return MAX_DATA_LEN;
+  }
+
+ protected:
+  friend class NibeGwFramePool;
+  frame_handle_type(NibeGwFramePool *pool, uint8_t slot) : pool_(pool), slot_(slot) {}
+
+  NibeGwFramePool *pool_ = nullptr;
+  uint8_t slot_ = 0;
+};
+
+// Frame buffers allocated once at startup, so request bursts never touch the heap.
+class NibeGwFramePool {
+ public:
+  explicit NibeGwFramePool(size_t capacity);
+
+  // An empty handle when all buffers are in use.
+  frame_handle_type acquire();
+
+  size_t capacity() const {
+    return capacity_;
+  }
+  size_t in_use() const {
+    return capacity_ - free_.size();
+  }
+  size_t high_water() const {
+    return high_water_;
+  }
+  uint32_t exhausted() const {
+    return exhausted_;
+  }
+
+ protected:
+  friend class frame_handle_type;
+
+  struct slot_type {
+    uint8_t data[MAX_DATA_LEN];
+    uint8_t len;
+  };
+
+  void release(uint8_t slot) {
+    free_.push_back(slot);
+  }
+
+  size_t capacity_;
+  std::unique_ptr<slot_type[]> slots_;
+  std::vector<uint8_t> free_; /* stack of free slots, never grows past capacity */
+  size_t high_water_ = 0;
+  uint32_t exhausted_ = 0;
+};
+
+// Fixed capacity double ended queue, storage is part of the object.
+template<typename T, size_t N> class NibeGwRing {
+ public:
+  bool empty() const {
+    return size_ == 0;
+  }
+  bool full() const {
+    return size_ == N;
+  }
+  size_t size() const {
+    return size_;
+  }
+
+  T &front() {
+    return items_[head_];
+  }
+
+  // Both return false and leave the item alone when full.
+  bool push_back(T &&item) {
+    if (full()) {
+      return false;
+    }
+    items_[(head_ + size_) % N] = std::move(item);
+    size_++;
+    return true;
+  }
+
+  bool push_front(T &&item) {
+    if (full()) {
+      return false;
+    }
+    head_ = (head_ + N - 1) % N;
+    items_[head_] = std::move(item);
+    size_++;
+    return true;
+  }
+
+  T pop_front() {
+    T item = std::move(items_[head_]);
+    items_[head_] = T();
+    head_ = (head_ + 1) % N;
+    size_--;
+    return item;
+  }
+
+ protected:
+  std::array<T, N> items_{};
+  size_t head_ = 0;
+  size_t size_ = 0;
+};
+
+}  // namespace nibegw
+}  // namespace esphome
@@ -0,0 +1,177 @@
+#include <algorithm>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+#include "NibeGwRegisters.h"
+#include "NibeGwComponent.h"
+#include "NibeGw.h"
+
+namespace esphome {
+namespace nibegw {
+
+static const char *TAG = "nibegw.registers";
+
+static const uint16_t REGISTER_UNUSED = 0xFFFF;
+static const size_t DATA_MSG_ENTRY_LEN = 4;
+static const size_t READ_RESP_LEN = 6;
+
+NibeGwRegisters::NibeGwRegisters(NibeGwComponent *gw, size_t capacity) : gw_(gw), capacity_(capacity) {
+  entries_.reserve(capacity_);
+
+  gw_->add_listener(MODBUS40, MODBUS_DATA_MSG, [this](const request_data_type &message) { handle_data_msg(message); });
+  gw_->add_listener(MODBUS40, READ_RESP, [this](const request_data_type &message) { handle_read_resp(message); });
+}
+
+void NibeGwRegisters::add_listener(uint16_t address, register_listener_type listener) {
+  listeners_.emplace_back(address, std::move(listener));
+}
+
+const register_entry_type *NibeGwRegisters::find(uint16_t address) const {
+  auto it = std::lower_bound(entries_.begin(), entries_.end(), address,
+                             [](const register_entry_type &entry, uint16_t value) { return entry.address < value; });
+  if (it == entries_.end() || it->address != address) {
+    return nullptr;
+  }
+  return &*it;
+}
+
+void NibeGwRegisters::update(uint16_t address, uint32_t value, bool stale) {
+  auto it = std::lower_bound(entries_.begin(), entries_.end(), address,
+                             [](const register_entry_type &entry, uint16_t value) { return entry.address < value; });
+  if (it == entries_.end() || it->address != address) {
+    if (entries_.size() >= capacity_) {
+      /* the value is not kept, but listeners of the register still see it */
+      if (!overflow_++) {
+        ESP_LOGW(TAG, "Register table full at %zu entries, register %u not kept", capacity_, address);
+      }
+      register_entry_type entry{address, value, stale ? 0 : millis(), stale};
+      notify(entry);
+      return;
+    }
+    it = entries_.insert(it, register_entry_type{address, value, 0, stale});
+    snapshot_dirty_ = true;
+  } else if (it->value != value) {
+    it->value = value;
+    snapshot_dirty_ = true;
+  }
+
+  if (!stale) {
+    it->stale = false;
+    it->timestamp = millis();
+  }
+
+  notify(*it);
+}
+
+void NibeGwRegisters::notify(const register_entry_type &entry) {
+  if (!entry.stale && update_listener_) {
+    update_listener_(entry);
+  }
+  for (auto &[listener_address, listener] : listeners_) {
+    if (listener_address == entry.address) {
+      listener(entry);
+    }
+  }
+}
+
+void NibeGwRegisters::handle_data_msg(const request_data_type &message) {
+  /* 20 entries of register and 16 bit value, a 32 bit register repeats its address with the high word */
+  uint16_t previous = REGISTER_UNUSED;
+  uint32_t low = 0;
+  for (size_t offset = 0; offset + DATA_MSG_ENTRY_LEN <= message.size(); offset += DATA_MSG_ENTRY_LEN) {
+    uint16_t address = get_u16(&message[offset]);
+    uint16_t value = get_u16(&message[offset + 2]);
+    if (address == REGISTER_UNUSED) {
+      previous = REGISTER_UNUSED;
+      continue;
+    }
+
+    if (address == previous) {
+      update(address, low | ((uint32_t) value << 16));
+      previous = REGISTER_UNUSED;
+      continue;
+    }
+
+    update(address, value);
+    previous = address;
+    low = value;
+  }
+}
+
+void NibeGwRegisters::handle_read_resp(const request_data_type &message) {
+  if (message.size() < READ_RESP_LEN) {
+    ESP_LOGW(TAG, "Invalid read response length: %zu", message.size());
+    return;
+  }
+  update(get_u16(&message[0]), get_u16(&message[2]) | ((uint32_t) get_u16(&message[4]) << 16));
+}
+
+void NibeGwRegisters::setup() {
+  if (!snapshot_interval_) {
+    return;
+  }
+  snapshot_pref_ = global_preferences->make_preference<register_snapshot_type>(fnv1_hash("nibegw_registers"), true);
+  load_snapshot();
+  snapshot_time_ = millis();
+}
+
+void NibeGwRegisters::load_snapshot() {
+  register_snapshot_type snapshot{};
+  if (!snapshot_pref_.load(&snapshot)) {
+    ESP_LOGD(TAG, "No register snapshot stored");
+    return;
+  }
+
+  size_t count = std::min<size_t>(snapshot.count, REGISTER_SNAPSHOT_MAX);
+  for (size_t i = 0; i < count; i++) {
+    update(snapshot.address[i], snapshot.value[i], true);
+  }
+  snapshot_dirty_ = false;
+  ESP_LOGI(TAG, "Restored %zu stale registers from snapshot", count);
+}
+
+void NibeGwRegisters::save_snapshot() {
+  if (!snapshot_interval_ || !snapshot_dirty_) {
+    return;
+  }
+
+  register_snapshot_type snapshot{};
+  for (auto &entry : entries_) {
+    if (snapshot.count >= REGISTER_SNAPSHOT_MAX) {
+      break;
+    }
+    snapshot.address[snapshot.count] = entry.address;
+    snapshot.value[snapshot.count] = entry.value;
+    snapshot.count++;
+  }
+
+  if (snapshot_pref_.save(&snapshot)) {
+    snapshot_dirty_ = false;
+    ESP_LOGD(TAG, "Saved %u registers to snapshot", snapshot.count);
+  } else {
+    ESP_LOGW(TAG, "Failed to save register snapshot");
+  }
+}
+
+void NibeGwRegisters::loop() {
+  /* only changed values are written, and never more often than the interval to limit flash wear */
+  uint32_t now = millis();
+  if (snapshot_interval_ && now - snapshot_time_ >= snapshot_interval_) {
+    snapshot_time_ = now;
+    save_snapshot();
+  }
+}
+
+void NibeGwRegisters::dump_config() {
+  size_t stale = std::count_if(entries_.begin(), entries_.end(), [](const auto &entry) { return entry.stale; });
+  ESP_LOGCONFIG(TAG, " Registers: %zu/%zu stale: %zu overflow: %u", entries_.size(), capacity_, stale,
+                (unsigned) overflow_);
+  if (snapshot_interval_) {
+    ESP_LOGCONFIG(TAG, " Snapshot interval: %u ms", (unsigned) snapshot_interval_);
+  }
+}
+
+}  // namespace nibegw
+}  // namespace esphome
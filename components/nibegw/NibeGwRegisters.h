@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "esphome/core/preferences.h"
+
+#include "NibeGwCodec.h"
+#include "NibeGwMemory.h"
+
+namespace esphome {
+namespace nibegw {
+
+class NibeGwComponent;
+
+// Latest known raw value of a pump register.
+struct register_entry_type {
+  uint16_t address;
+  uint32_t value;
+  uint32_t timestamp; /* millis() of last update from the bus */
+  bool stale;         /* restored from snapshot, not yet seen on the bus */
+};
+
+typedef std::function<void(const register_entry_type &entry)> register_listener_type;
+
+static const size_t REGISTER_SNAPSHOT_MAX = 64;
+
+// Compact copy of the register table persisted to flash.
+struct register_snapshot_type {
+  uint16_t count;
+  uint16_t address[REGISTER_SNAPSHOT_MAX];
+  uint32_t value[REGISTER_SNAPSHOT_MAX];
+};
+
+// Register values decoded from MODBUS40 data telegrams and read responses,
+// kept in a fixed capacity table sorted by register address.
+class NibeGwRegisters {
+ public:
+  NibeGwRegisters(NibeGwComponent *gw, size_t capacity);
+
+  void set_snapshot_interval(uint32_t interval) {
+    snapshot_interval_ = interval;
+  }
+
+  void add_listener(uint16_t address, register_listener_type listener);
+  // Called for every register update seen on the bus.
+  void set_update_listener(register_listener_type listener) {
+    update_listener_ = std::move(listener);
+  }
+
+  const register_entry_type *find(uint16_t address) const;
+
+  size_t size() const {
+    return entries_.size();
+  }
+  size_t memory_bytes() const {
+    return vector_bytes(entries_) + vector_bytes(listeners_);
+  }
+  void update(uint16_t address, uint32_t value, bool stale = false);
+
+  void setup();
+  void loop();
+  void dump_config();
+  void save_snapshot();
+
+ protected:
+  void handle_data_msg(const request_data_type &message);
+  void handle_read_resp(const request_data_type &message);
+  void load_snapshot();
+  void notify(const register_entry_type &entry);
+
+  NibeGwComponent *gw_;
+  size_t capacity_;
+  std::vector<register_entry_type> entries_;
+  std::vector<std::pair<uint16_t, register_listener_type>> listeners_;
+  uint32_t overflow_ = 0; /* updates of registers that did not fit in the table */
+  register_listener_type update_listener_;
+
+  uint32_t snapshot_interval_ = 0;
+  uint32_t snapshot_time_ = 0;
+  bool snapshot_dirty_ = false;
+  ESPPreferenceObject snapshot_pref_;
+};
+
+}  // namespace nibegw
+}  // namespace esphome
@@ -0,0 +1,136 @@
+#include <cmath>
+#include <algorithm>
+
+#include "esphome/core/log.h"
+
+#include "NibeGwRmu.h"
+#include "NibeGwClimate.h"
+#include "NibeGwComponent.h"
+#include "NibeGw.h"
+
+namespace esphome {
+namespace nibegw {
+
+static const char *TAG = "nibegw.rmu";
+
+static const int RMU_DEVICE_VERSION = 0x0103;
+
+#define RMU_ADDRESS(system) (RMU40_S1 + (system))
+
+#define RMU_WRITE_MASK(system, index) (1ull << ((system) *RMU_WRITE_INDEX_END + (index)))
+
+#define RMU_WRITE_MASK_SYSTEM(system) (((1ull << RMU_WRITE_INDEX_END) - 1) << ((system) *RMU_WRITE_INDEX_END))
+
+/* set points are handed out before anything else, such as the room temperature */
+#define RMU_WRITE_MASK_SETPOINTS(system) \
+  (RMU_WRITE_MASK(system, RMU_WRITE_INDEX_SETPOINT_S1) | RMU_WRITE_MASK(system, RMU_WRITE_INDEX_SETPOINT_S2) | \
+   RMU_WRITE_MASK(system, RMU_WRITE_INDEX_SETPOINT_S3) | RMU_WRITE_MASK(system, RMU_WRITE_INDEX_SETPOINT_S4))
+
+enum RmuDataOffset {
+  RMU_DATA_OFFSET_TARGET_TEMPERATURE_S1 = 4,
+  RMU_DATA_OFFSET_TARGET_TEMPERATURE_S2 = 5,
+  RMU_DATA_OFFSET_TARGET_TEMPERATURE_S3 = 6,
+  RMU_DATA_OFFSET_TARGET_TEMPERATURE_S4 = 7,
+  RMU_DATA_OFFSET_CURRENT_TEMPERATURE_SX = 8,
+  RMU_DATA_OFFSET_FLAGS1 = 15,
+  RMU_DATA_OFFSET_FLAGS0 = 16,
+  RMU_DATA_OFFSET_MAX = 25,
+};
+
+#define RMU_DATA_OFFSET_TARGET_TEMPERATURE_SX(index) (RMU_DATA_OFFSET_TARGET_TEMPERATURE_S1 + (index))
+
+enum RmuDataFlagsBits {
+  RMU_DATA_FLAGS0_USE_ROOM_SENSOR_S4 = 0x80,
+  RMU_DATA_FLAGS0_USE_ROOM_SENSOR_S3 = 0x40,
+  RMU_DATA_FLAGS0_USE_ROOM_SENSOR_S2 = 0x20,
+  RMU_DATA_FLAGS0_USE_ROOM_SENSOR_S1 = 0x10,
+};
+
+#define RMU_DATA_FLAGS0_USE_ROOM_SENSOR_SX(index) (RMU_DATA_FLAGS0_USE_ROOM_SENSOR_S1 << (index))
+
+void NibeGwRmu::add_system(int system, NibeGwClimate *climate) {
+  if (climates_[system]) {
+    ESP_LOGE(TAG, "System %d already has a climate", system + 1);
+    return;
+  }
+  climates_[system] = climate;
+
+  const int address = RMU_ADDRESS(system);
+
+  /* setup response to write requests */
+  gw_->set_request(address, RMU_WRITE_TOKEN, [this, system](uint8_t *data) { return write_next_data(system, data); });
+
+  /* setup response to accessory information */
+  gw_->set_request(address, ACCESSORY_TOKEN,
+                   build_request_data(ACCESSORY_TOKEN, set_u16_index(0xEE, RMU_DEVICE_VERSION)));
+
+  /* setup response to something odd we don't know, copied from nibepi */
+  gw_->set_request(address, RMU_DATA_TOKEN, build_request_data(RMU_WRITE_TOKEN, {0x63, 0x00}));
+
+  gw_->add_listener(address, RMU_DATA_MSG,
+                    [this, system](const request_data_type &message) { handle_data(system, message); });
+
+  gw_->gw().setAcknowledge(address, true);
+}
+
+void NibeGwRmu::set_data(int system, int index, const uint8_t data[2]) {
+  /* a newer value replaces one that has not been sent yet */
+  std::copy_n(data, 2, slots_[system][index]);
+  dirty_ |= RMU_WRITE_MASK(system, index);
+}
+
+int NibeGwRmu::next_data(int system) {
+  uint64_t pending = dirty_ & RMU_WRITE_MASK_SETPOINTS(system);
+  if (!pending) {
+    pending = dirty_ & RMU_WRITE_MASK_SYSTEM(system);
+  }
+  if (!pending) {
+    return -1;
+  }
+  return __builtin_ctzll(pending) - system * RMU_WRITE_INDEX_END;
+}
+
+int NibeGwRmu::write_next_data(int system, uint8_t *data) {
+  int index = next_data(system);
+  if (index < 0) {
+    return 0;
+  }
+  dirty_ &= ~RMU_WRITE_MASK(system, index);
+
+  const uint8_t *value = slots_[system][index];
+  ESP_LOGD(TAG, "Responding to rmu: 0x%x index: 0x%x data: %02X %02X", RMU_ADDRESS(system), index, value[0],
+           value[1]);
+
+  const uint8_t payload[] = {(uint8_t) index, value[0], value[1]};
+  return build_request_data(RMU_WRITE_TOKEN, payload, sizeof(payload), data);
+}
+
+void NibeGwRmu::handle_data(int system, const request_data_type &message) {
+  if (message.size() < RMU_DATA_OFFSET_MAX) {
+    ESP_LOGW(TAG, "Invalid data length: %zu", message.size());
+    return;
+  }
+
+  /* every message carries the set points of all systems, but each system gets its own message every cycle, so only
+   * the addressed climate is refreshed */
+  float target = NAN;
+  if (message[RMU_DATA_OFFSET_FLAGS0] & RMU_DATA_FLAGS0_USE_ROOM_SENSOR_SX(system)) {
+    target = get_u8_decimal(&message[RMU_DATA_OFFSET_TARGET_TEMPERATURE_SX(system)], 0.1, 50);
+  }
+  climates_[system]->handle_rmu_target(target);
+
+  /* this field has an added 0.5 degrees, to trigger rounding in RMU, subtract off before checking invalid values */
+  climates_[system]->handle_rmu_current(get_s16_decimal(&message[RMU_DATA_OFFSET_CURRENT_TEMPERATURE_SX], 0.1, -5));
+}
+
+void NibeGwRmu::dump_config() {
+  for (int system = 0; system < RMU_SYSTEMS; system++) {
+    if (climates_[system]) {
+      ESP_LOGCONFIG(TAG, " RMU40 S%d: 0x%x pending: 0x%04x", system + 1, RMU_ADDRESS(system),
+                    (unsigned) ((dirty_ & RMU_WRITE_MASK_SYSTEM(system)) >> (system * RMU_WRITE_INDEX_END)));
+    }
+  }
+}
+
+}  // namespace nibegw
+}  // namespace esphome
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "NibeGwCodec.h"
+
+namespace esphome {
+namespace nibegw {
+
+class NibeGwComponent;
+class NibeGwClimate;
+
+enum RmuWriteIndex {
+  RMU_WRITE_INDEX_TEMPORARY_LUX = 2,
+  RMU_WRITE_INDEX_OPERATIONAL_MODE = 4,
+  RMU_WRITE_INDEX_FUNCTIONS = 5,
+  RMU_WRITE_INDEX_TEMPERATURE = 6,
+  RMU_WRITE_INDEX_SETPOINT_S1 = 9,
+  RMU_WRITE_INDEX_SETPOINT_S2 = 11,
+  RMU_WRITE_INDEX_SETPOINT_S3 = 13,
+  RMU_WRITE_INDEX_SETPOINT_S4 = 15,
+
+  RMU_WRITE_INDEX_END = RMU_WRITE_INDEX_SETPOINT_S4 + 1
+};
+
+#define RMU_WRITE_INDEX_SETPOINT_SX(index) (RMU_WRITE_INDEX_SETPOINT_S1 + (index) *2)
+
+static const int RMU_SYSTEMS = 4;
+
+// Emulates RMU40 accessories for all climate systems of a gateway. The RMU
+// data message to each address updates the climate of that system, and
+// pending writes for all systems share one slot table and dirty mask.
+class NibeGwRmu {
+ public:
+  explicit NibeGwRmu(NibeGwComponent *gw) : gw_(gw) {}
+
+  // Start emulating the RMU40 of system (0-3), reporting to climate.
+  void add_system(int system, NibeGwClimate *climate);
+
+  // Queue a write of index for system, replacing any unsent value.
+  void set_data(int system, int index, const uint8_t data[2]);
+
+  // Climate of system, null when none is attached.
+  NibeGwClimate *climate(int system) const {
+    return climates_[system];
+  }
+
+  void dump_config();
+
+ protected:
+  int next_data(int system);
+  int write_next_data(int system, uint8_t *data);
+  void handle_data(int system, const request_data_type &message);
+
+  NibeGwComponent *gw_;
+  NibeGwClimate *climates_[RMU_SYSTEMS]{};
+  uint8_t slots_[RMU_SYSTEMS][RMU_WRITE_INDEX_END][2]; /* latest value for each write index */
+  uint64_t dirty_{0};                                  /* bit per system and index with a value not yet sent */
+};
+
+}  // namespace nibegw
+}  // namespace esphome
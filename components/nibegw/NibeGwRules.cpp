@@ -0,0 +1,91 @@
+#include <cmath>
+
+#include "esphome/core/log.h"
+
+#include "NibeGwRules.h"
+#include "NibeGwClimate.h"
+#include "NibeGwComponent.h"
+#include "NibeGw.h"
+
+namespace esphome {
+namespace nibegw {
+
+static const char *TAG = "nibegw.rules";
+
+void NibeGwRules::setup() {
+  auto &registers = gw_->registers();
+  for (auto &rule : rules_) {
+    registers.add_listener(rule.address, [this, &rule](const register_entry_type &reg) { evaluate(rule, reg); });
+  }
+}
+
+void NibeGwRules::evaluate(rule_type &rule, const register_entry_type &reg) {
+  /* restored values may be long outdated, never act on them */
+  if (reg.stale) {
+    return;
+  }
+  float value = get_register_value(reg.value, rule.type);
+  if (std::isnan(value)) {
+    return;
+  }
+  value *= rule.factor;
+
+  bool active;
+  if (rule.op == RULE_OP_BELOW) {
+    active = rule.active ? value < rule.threshold + rule.hysteresis : value < rule.threshold;
+  } else {
+    active = rule.active ? value > rule.threshold - rule.hysteresis : value > rule.threshold;
+  }
+
+  if (active == rule.active) {
+    return;
+  }
+  rule.active = active;
+
+  if (active) {
+    rule.triggers++;
+    ESP_LOGI(TAG, "Register %u value %.1f triggered rule", rule.address, value);
+    apply(rule, rule.value);
+  } else if (rule.has_release) {
+    ESP_LOGI(TAG, "Register %u value %.1f released rule", rule.address, value);
+    apply(rule, rule.release);
+  }
+}
+
+void NibeGwRules::apply(const rule_type &rule, float value) {
+  switch (rule.action) {
+    case RULE_ACTION_WRITE: {
+      const uint16_t target = rule.target;
+      gw_->write_register(target, (uint32_t) (int32_t) std::lround(value),
+                          [target](request_status_type status, const uint8_t *data, int len) {
+                            if (status != REQUEST_STATUS_OK) {
+                              ESP_LOGW(TAG, "Rule write to register %u failed: %d", target, status);
+                            }
+                          });
+      break;
+    }
+    case RULE_ACTION_SETPOINT: {
+      /* the climate sends it, so the set point it shows stays in line with the pump */
+      auto *climate = gw_->rmu().climate(rule.target);
+      if (!climate) {
+        ESP_LOGW(TAG, "Rule set point for system %u has no climate to send it", rule.target + 1);
+        break;
+      }
+      climate->apply_set_point(value);
+      break;
+    }
+  }
+}
+
+void NibeGwRules::dump_config() {
+  ESP_LOGCONFIG(TAG, " Rules: %zu", rules_.size());
+  for (auto &rule : rules_) {
+    ESP_LOGCONFIG(TAG, "  Register: %u %s %.1f action: %s %u triggers: %u%s", rule.address,
+                  rule.op == RULE_OP_BELOW ? "below" : "above", rule.threshold,
+                  rule.action == RULE_ACTION_WRITE ? "write" : "setpoint", rule.target, rule.triggers,
+                  rule.active ? " (active)" : "");
+  }
+}
+
+}  // namespace nibegw
+}  // namespace esphome
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "NibeGwRegisters.h"
+
+namespace esphome {
+namespace nibegw {
+
+class NibeGwComponent;
+
+enum rule_op_type : uint8_t {
+  RULE_OP_BELOW,
+  RULE_OP_ABOVE,
+};
+
+enum rule_action_type : uint8_t {
+  RULE_ACTION_WRITE,    /* write value to the MODBUS40 register in target */
+  RULE_ACTION_SETPOINT, /* set point of the RMU40 system (0-3) in target */
+};
+
+// One entry of the rule table, generated from the configuration.
+struct rule_type {
+  uint16_t address;
+  register_type type;
+  rule_op_type op;
+  float factor;
+  float threshold;
+  float hysteresis;
+  rule_action_type action;
+  uint16_t target;
+  float value;
+  float release;     /* value applied when the condition clears */
+  bool has_release;
+
+  bool active = false;
+  uint16_t triggers = 0;
+};
+
+// Evaluates threshold rules on register values as they are decoded from
+// the bus, and acts on the pump without a round trip over the network.
+// Rules are edge triggered, with hysteresis on the way back.
+class NibeGwRules {
+ public:
+  explicit NibeGwRules(NibeGwComponent *gw) : gw_(gw) {}
+
+  void add_rule(const rule_type &rule) {
+    rules_.push_back(rule);
+  }
+
+  void setup();
+  void dump_config();
+
+ protected:
+  void evaluate(rule_type &rule, const register_entry_type &reg);
+  void apply(const rule_type &rule, float value);
+
+  NibeGwComponent *gw_;
+  std::vector<rule_type> rules_;
+};
+
+}  // namespace nibegw
+}  // namespace esphome
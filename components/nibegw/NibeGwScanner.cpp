@@ -0,0 +1,78 @@
+#include <algorithm>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include "NibeGwScanner.h"
+#include "NibeGwComponent.h"
+#include "NibeGw.h"
+
+namespace esphome {
+namespace nibegw {
+
+static const char *TAG = "nibegw.scanner";
+
+static const uint8_t SCAN_CHANGES_MAX = 15;
+
+void NibeGwScanner::setup() {
+  auto &registers = gw_->registers();
+  for (auto &entry : entries_) {
+    registers.add_listener(entry.address,
+                           [this, &entry](const register_entry_type &reg) { handle_register(entry, reg); });
+  }
+}
+
+void NibeGwScanner::handle_register(scan_entry_type &entry, const register_entry_type &reg) {
+  if (reg.stale) {
+    return;
+  }
+  if (reg.value != entry.value && entry.changes < SCAN_CHANGES_MAX) {
+    entry.changes++;
+  }
+  entry.value = reg.value;
+}
+
+int NibeGwScanner::write_next_request(uint8_t *data) {
+  uint32_t now = millis();
+  auto &registers = gw_->registers();
+
+  scan_entry_type *best = nullptr;
+  uint64_t best_score = 0;
+  for (auto &entry : entries_) {
+    /* registers never seen since boot are always the most overdue */
+    uint32_t updated = entry.requested;
+    auto *reg = registers.find(entry.address);
+    if (reg && !reg->stale) {
+      updated = std::max(updated, reg->timestamp);
+    }
+    uint32_t age = (updated || entry.scans) ? now - updated : UINT32_MAX;
+
+    uint64_t score = (uint64_t) age * (1 + entry.changes);
+    if (!best || score > best_score) {
+      best = &entry;
+      best_score = score;
+    }
+  }
+
+  if (!best) {
+    return 0;
+  }
+
+  best->requested = now;
+  best->changes /= 2;
+  best->scans++;
+
+  ESP_LOGV(TAG, "Scanning register %u", best->address);
+  const uint8_t payload[] = {(uint8_t) (best->address & 0xff), (uint8_t) (best->address >> 8)};
+  return build_request_data(READ_TOKEN, payload, sizeof(payload), data);
+}
+
+void NibeGwScanner::dump_config() {
+  ESP_LOGCONFIG(TAG, " Scanning %zu registers", entries_.size());
+  for (auto &entry : entries_) {
+    ESP_LOGCONFIG(TAG, "  Register: %u scans: %u", entry.address, (unsigned) entry.scans);
+  }
+}
+
+}  // namespace nibegw
+}  // namespace esphome
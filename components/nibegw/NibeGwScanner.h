@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "NibeGwRegisters.h"
+
+namespace esphome {
+namespace nibegw {
+
+class NibeGwComponent;
+
+// Reads configured registers in READ_TOKEN slots that no client request
+// claimed, picking the register that is most overdue weighted by how often
+// its value changes.
+class NibeGwScanner {
+ public:
+  explicit NibeGwScanner(NibeGwComponent *gw) : gw_(gw) {}
+
+  void add_register(uint16_t address) {
+    entries_.push_back({address});
+  }
+
+  void setup();
+  void dump_config();
+
+  // Build a read request for the next register, returns 0 if there is none.
+  int write_next_request(uint8_t *data);
+
+ protected:
+  struct scan_entry_type {
+    uint16_t address;
+    uint32_t requested = 0; /* millis() of last read request */
+    uint32_t value = 0;     /* last seen value */
+    uint8_t changes = 0;    /* decaying count of value changes */
+    uint32_t scans = 0;
+  };
+
+  void handle_register(scan_entry_type &entry, const register_entry_type &reg);
+
+  NibeGwComponent *gw_;
+  std::vector<scan_entry_type> entries_;
+};
+
+}  // namespace nibegw
+}  // namespace esphome
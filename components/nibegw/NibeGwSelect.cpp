@@ -0,0 +1,61 @@
+#include <cmath>
+#include <algorithm>
+
+#include "esphome/core/log.h"
+
+#include "NibeGwSelect.h"
+#include "NibeGwComponent.h"
+
+namespace esphome {
+namespace nibegw {
+
+static const char *TAG = "nibegw.select";
+
+void NibeGwSelect::setup() {
+  auto &registers = this->gw_->registers();
+  registers.add_listener(this->address_, [this](const register_entry_type &entry) { this->handle_register(entry); });
+  if (auto *entry = registers.find(this->address_)) {
+    this->handle_register(*entry);
+  }
+}
+
+void NibeGwSelect::handle_register(const register_entry_type &entry) {
+  float value = get_register_value(entry.value, this->type_);
+  if (std::isnan(value)) {
+    return;
+  }
+
+  auto it = std::find(this->values_.begin(), this->values_.end(), (int32_t) value);
+  if (it == this->values_.end()) {
+    ESP_LOGW(TAG, "'%s': no option for value %f", this->get_name().c_str(), value);
+    return;
+  }
+
+  auto option = this->at(it - this->values_.begin());
+  if (option.has_value()) {
+    this->publish_state(*option);
+  }
+}
+
+void NibeGwSelect::control(const std::string &value) {
+  auto index = this->index_of(value);
+  if (!index.has_value() || *index >= this->values_.size()) {
+    return;
+  }
+
+  uint32_t raw = set_register_value(this->values_[*index], 1.0, this->type_);
+  ESP_LOGD(TAG, "'%s': writing %s -> 0x%08X", this->get_name().c_str(), value.c_str(), (unsigned) raw);
+  this->gw_->write_register(this->address_, raw, [this](request_status_type status, const uint8_t *data, int len) {
+    if (status != REQUEST_STATUS_OK) {
+      ESP_LOGW(TAG, "'%s': write failed: %d", this->get_name().c_str(), status);
+    }
+  });
+}
+
+void NibeGwSelect::dump_config() {
+  LOG_SELECT("", "NibeGw Register Select", this);
+  ESP_LOGCONFIG(TAG, "  Register: %u", this->address_);
+}
+
+}  // namespace nibegw
+}  // namespace esphome
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "esphome/core/component.h"
+#include "esphome/components/select/select.h"
+
+#include "NibeGwCodec.h"
+#include "NibeGwRegisters.h"
+
+namespace esphome {
+namespace nibegw {
+
+class NibeGwComponent;
+
+// Exposes an enumerated pump register as a select, each option maps to a raw value.
+class NibeGwSelect : public select::Select, public Component {
+ public:
+  void setup() override;
+  void dump_config() override;
+  void set_gw(NibeGwComponent *gw) {
+    this->gw_ = gw;
+  }
+  void set_register(uint16_t address) {
+    this->address_ = address;
+  }
+  void set_type(register_type type) {
+    this->type_ = type;
+  }
+  void set_values(std::vector<int32_t> values) {
+    this->values_ = std::move(values);
+  }
+
+ protected:
+  void control(const std::string &value) override;
+  void handle_register(const register_entry_type &entry);
+
+  NibeGwComponent *gw_{nullptr};
+  uint16_t address_;
+  register_type type_{REGISTER_TYPE_U8};
+  std::vector<int32_t> values_; /* raw value of each option, in option order */
+};
+
+}  // namespace nibegw
+}  // namespace esphome
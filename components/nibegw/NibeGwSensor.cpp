@@ -0,0 +1,53 @@
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+#include "NibeGwSensor.h"
+#include "NibeGwComponent.h"
+
+namespace esphome {
+namespace nibegw {
+
+static const char *TAG = "nibegw.sensor";
+
+void NibeGwRegisterSensor::setup() {
+  auto &registers = this->gw_->registers();
+  registers.add_listener(this->address_, [this](const register_entry_type &entry) { this->handle_register(entry); });
+
+  /* values restored from the snapshot before we attached are published right away */
+  if (auto *entry = registers.find(this->address_)) {
+    this->handle_register(*entry);
+  }
+}
+
+void NibeGwRegisterSensor::handle_register(const register_entry_type &entry) {
+  float value = get_register_value(entry.value, this->type_) * this->factor_;
+  this->stale_ = entry.stale;
+  if (entry.stale) {
+    if (!this->publish_stale_) {
+      return;
+    }
+    ESP_LOGD(TAG, "'%s': publishing stale value %f from snapshot", this->get_name().c_str(), value);
+  }
+  this->publish_state(value);
+}
+
+void NibeGwRegisterSensor::dump_config() {
+  LOG_SENSOR("", "NibeGw Register Sensor", this);
+  ESP_LOGCONFIG(TAG, "  Register: %u", this->address_);
+  ESP_LOGCONFIG(TAG, "  Publish stale: %s", YESNO(this->publish_stale_));
+}
+
+void NibeGwMetricSensor::update() {
+  this->publish_state(this->gw_->memory().metric(this->metric_, this->structure_));
+}
+
+void NibeGwMetricSensor::dump_config() {
+  LOG_SENSOR("", "NibeGw Metric Sensor", this);
+  if (this->metric_ == MEMORY_METRIC_COUNT || this->metric_ == MEMORY_METRIC_COUNT_MAX) {
+    ESP_LOGCONFIG(TAG, "  Structure: %s", NibeGwMemory::name(this->structure_));
+  }
+  LOG_UPDATE_INTERVAL(this);
+}
+
+}  // namespace nibegw
+}  // namespace esphome
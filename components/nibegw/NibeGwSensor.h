@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+
+#include "esphome/core/component.h"
+#include "esphome/components/sensor/sensor.h"
+
+#include "NibeGwCodec.h"
+#include "NibeGwRegisters.h"
+#include "NibeGwMemory.h"
+
+namespace esphome {
+namespace nibegw {
+
+class NibeGwComponent;
+
+// Publishes the value of a pump register as seen on the bus.
+class NibeGwRegisterSensor : public sensor::Sensor, public Component {
+ public:
+  void setup() override;
+  void dump_config() override;
+  void set_gw(NibeGwComponent *gw) {
+    this->gw_ = gw;
+  }
+  void set_register(uint16_t address) {
+    this->address_ = address;
+  }
+  void set_type(register_type type) {
+    this->type_ = type;
+  }
+  void set_factor(float factor) {
+    this->factor_ = factor;
+  }
+  void set_publish_stale(bool publish_stale) {
+    this->publish_stale_ = publish_stale;
+  }
+
+  // True while the state is a value restored from the snapshot that the pump has not sent again yet.
+  bool is_stale() const {
+    return this->stale_;
+  }
+
+ protected:
+  void handle_register(const register_entry_type &entry);
+
+  NibeGwComponent *gw_{nullptr};
+  uint16_t address_;
+  register_type type_{REGISTER_TYPE_S16};
+  float factor_{1.0};
+  bool publish_stale_{true};
+  bool stale_{false};
+};
+
+// Publishes a memory metric of the gateway at the update interval.
+class NibeGwMetricSensor : public sensor::Sensor, public PollingComponent {
+ public:
+  void update() override;
+  void dump_config() override;
+  void set_gw(NibeGwComponent *gw) {
+    this->gw_ = gw;
+  }
+  void set_metric(memory_metric_type metric, memory_structure_type structure) {
+    this->metric_ = metric;
+    this->structure_ = structure;
+  }
+
+ protected:
+  NibeGwComponent *gw_{nullptr};
+  memory_metric_type metric_{MEMORY_METRIC_FREE_HEAP};
+  memory_structure_type structure_{MEMORY_REQUESTS};
+};
+
+}  // namespace nibegw
+}  // namespace esphome
@@ -0,0 +1,219 @@
+#ifdef USE_HOST
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include "NibeGwSharedRing.h"
+
+namespace esphome {
+namespace nibegw {
+
+static const char *TAG = "nibegw.ring";
+
+NibeGwSharedRing::~NibeGwSharedRing() {
+  if (map_) {
+    munmap(map_, size());
+  }
+}
+
+bool NibeGwSharedRing::open() {
+  int fd = ::open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    ESP_LOGE(TAG, "Failed to open %s, error: %d", path_.c_str(), errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    ESP_LOGE(TAG, "Failed to stat %s, error: %d", path_.c_str(), errno);
+    close(fd);
+    return false;
+  }
+  if ((size_t) st.st_size != size()) {
+    /* readers may still map the file, shrinking it under them would fault their next access */
+    if (st.st_size) {
+      fd = replace(fd);
+      if (fd < 0) {
+        return false;
+      }
+    } else if (ftruncate(fd, size()) < 0) {
+      ESP_LOGE(TAG, "Failed to size %s to %zu bytes, error: %d", path_.c_str(), size(), errno);
+      close(fd);
+      return false;
+    }
+  }
+  void *map = mmap(nullptr, size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  /* the mapping stays valid after the descriptor is closed */
+  close(fd);
+  if (map == MAP_FAILED) {
+    ESP_LOGE(TAG, "Failed to map %s, error: %d", path_.c_str(), errno);
+    return false;
+  }
+
+  map_ = static_cast<uint8_t *>(map);
+  header_ = reinterpret_cast<shared_ring_header_type *>(map_);
+  cursors_ = reinterpret_cast<shared_ring_cursor_type *>(map_ + sizeof(shared_ring_header_type));
+  slots_ = reinterpret_cast<shared_ring_slot_type *>(map_ + sizeof(shared_ring_header_type) +
+                                                     reader_count_ * sizeof(shared_ring_cursor_type));
+
+  uint32_t generation = 0;
+  if (resumable()) {
+    generation = header_->generation.load(std::memory_order_relaxed);
+    next_ = header_->head.load(std::memory_order_relaxed);
+    /* records are written in order, so only the slot after HEAD can have been left half written */
+    auto &slot = slots_[next_ % slot_count_];
+    uint32_t lock = slot.lock.load(std::memory_order_relaxed);
+    if (lock & 1) {
+      slot.seq = UINT64_MAX;
+      slot.lock.store(lock + 1, std::memory_order_release);
+    }
+    ESP_LOGI(TAG, "Resuming %s at record %llu", path_.c_str(), (unsigned long long) next_);
+  } else {
+    if (__atomic_load_n(&header_->magic, __ATOMIC_ACQUIRE) == SHARED_RING_MAGIC) {
+      generation = header_->generation.load(std::memory_order_relaxed);
+    }
+    reset();
+  }
+  header_->generation.store(generation + 1, std::memory_order_release);
+  __atomic_store_n(&header_->magic, SHARED_RING_MAGIC, __ATOMIC_RELEASE);
+  report_last_ = millis();
+  return true;
+}
+
+int NibeGwSharedRing::replace(int fd) {
+  std::string temp = path_ + ".new";
+  int replacement = ::open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (replacement < 0 || ftruncate(replacement, size()) < 0 || rename(temp.c_str(), path_.c_str()) < 0) {
+    ESP_LOGE(TAG, "Failed to replace %s with a file of %zu bytes, error: %d", path_.c_str(), size(), errno);
+    if (replacement >= 0) {
+      close(replacement);
+      unlink(temp.c_str());
+    }
+    close(fd);
+    return -1;
+  }
+
+  /* readers of the old file keep a valid mapping, the cleared magic tells them to open the path again */
+  const uint32_t magic = 0;
+  if (pwrite(fd, &magic, sizeof(magic), 0) < 0) {
+    ESP_LOGW(TAG, "Failed to retire the previous %s, error: %d", path_.c_str(), errno);
+  }
+  close(fd);
+  ESP_LOGI(TAG, "Replaced %s with a file of %zu bytes", path_.c_str(), size());
+  return replacement;
+}
+
+bool NibeGwSharedRing::resumable() const {
+  return __atomic_load_n(&header_->magic, __ATOMIC_ACQUIRE) == SHARED_RING_MAGIC &&
+         header_->version == SHARED_RING_VERSION && header_->slot_size == sizeof(shared_ring_slot_type) &&
+         header_->slot_count == slot_count_ && header_->reader_count == reader_count_;
+}
+
+void NibeGwSharedRing::reset() {
+  /* readers wait for the magic, so it is cleared first and set once the rest is in place */
+  __atomic_store_n(&header_->magic, 0, __ATOMIC_RELEASE);
+  std::memset(map_ + sizeof(header_->magic), 0, size() - sizeof(header_->magic));
+  header_->version = SHARED_RING_VERSION;
+  header_->slot_size = sizeof(shared_ring_slot_type);
+  header_->slot_count = slot_count_;
+  header_->reader_count = reader_count_;
+  next_ = 0;
+}
+
+void NibeGwSharedRing::write(shared_ring_record_type kind, uint8_t bus, uint32_t time, const uint8_t *data,
+                             size_t len) {
+  auto &slot = slots_[next_ % slot_count_];
+  uint32_t lock = slot.lock.load(std::memory_order_relaxed);
+  slot.lock.store(lock + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  len = std::min(len, sizeof(slot.data));
+  slot.len = len;
+  slot.kind = kind;
+  slot.bus = bus;
+  slot.seq = next_;
+  slot.time = time;
+  std::memcpy(slot.data, data, len);
+
+  slot.lock.store(lock + 2, std::memory_order_release);
+  header_->head.store(++next_, std::memory_order_release);
+}
+
+void NibeGwSharedRing::write_frame(uint8_t bus, uint32_t time, const uint8_t *data, size_t len) {
+  write(SHARED_RING_FRAME, bus, time, data, len);
+}
+
+void NibeGwSharedRing::write_register(uint16_t address, uint32_t value, uint32_t time) {
+  uint8_t data[sizeof(address) + sizeof(value)];
+  std::memcpy(data, &address, sizeof(address));
+  std::memcpy(data + sizeof(address), &value, sizeof(value));
+  write(SHARED_RING_REGISTER, 0, time, data, sizeof(data));
+}
+
+bool NibeGwSharedRing::live_reader(uint32_t index, uint32_t &pid, uint64_t &behind, uint64_t &lost) const {
+  auto &cursor = cursors_[index];
+  pid = cursor.owner.load(std::memory_order_relaxed);
+  if (!pid || kill(pid, 0) < 0) {
+    return false;
+  }
+  behind = next_ - std::min(next_, cursor.position.load(std::memory_order_relaxed));
+  lost = cursor.lost.load(std::memory_order_relaxed);
+  return true;
+}
+
+void NibeGwSharedRing::loop(uint32_t now) {
+  if (!report_interval_ || now - report_last_ < report_interval_) {
+    return;
+  }
+  report_last_ = now;
+
+  uint64_t lost_total = 0;
+  for (uint32_t i = 0; i < reader_count_; i++) {
+    uint32_t pid;
+    uint64_t behind, lost;
+    if (!live_reader(i, pid, behind, lost)) {
+      continue;
+    }
+    ESP_LOGD(TAG, "Reader %u: pid %u, %llu behind, %llu lost", (unsigned) i, (unsigned) pid,
+             (unsigned long long) behind, (unsigned long long) lost);
+    lost_total += lost;
+  }
+  if (lost_total > lost_) {
+    ESP_LOGW(TAG, "Readers lost %llu records in the last %u ms", (unsigned long long) (lost_total - lost_),
+             (unsigned) report_interval_);
+  }
+  lost_ = lost_total;
+}
+
+void NibeGwSharedRing::dump_config() {
+  ESP_LOGCONFIG(TAG, "NibeGw Shared Ring");
+  ESP_LOGCONFIG(TAG, " Path: %s, %u slots of %u bytes, %u readers, report interval %u ms", path_.c_str(),
+                (unsigned) slot_count_, (unsigned) sizeof(shared_ring_slot_type), (unsigned) reader_count_,
+                (unsigned) report_interval_);
+  if (!header_) {
+    return;
+  }
+  ESP_LOGCONFIG(TAG, " Generation: %u", (unsigned) header_->generation.load(std::memory_order_relaxed));
+  for (uint32_t i = 0; i < reader_count_; i++) {
+    uint32_t pid;
+    uint64_t behind, lost;
+    if (live_reader(i, pid, behind, lost)) {
+      ESP_LOGCONFIG(TAG, " Reader %u: pid %u, %llu behind, %llu lost", (unsigned) i, (unsigned) pid,
+                    (unsigned long long) behind, (unsigned long long) lost);
+    }
+  }
+}
+
+}  // namespace nibegw
+}  // namespace esphome
+
+#endif
@@ -0,0 +1,140 @@
+#pragma once
+
+#ifdef USE_HOST
+
+#include <atomic>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+#include "NibeGw.h"
+
+namespace esphome {
+namespace nibegw {
+
+// Memory mapped ring of bus frames and register updates for readers on the
+// same host. There is a single writer, and any number of readers that never
+// block it or each other. All integers are in native byte order.
+//
+// The file starts with a 64 byte header:
+// +----------+--------+-----------+------------+--------------+---------+--------+
+// | MAGIC(4) | VER(2) | SLOT_SIZE | SLOT_COUNT | READER_COUNT | HEAD(8) | GEN(4) |
+// |          |        |    (2)    |    (4)     |     (4)      |         |        |
+// +----------+--------+-----------+------------+--------------+---------+--------+
+// HEAD is the number of records written so far, record n is kept in slot
+// n % SLOT_COUNT. The header is followed by READER_COUNT cursors of 64 bytes
+// and then by the slots.
+//
+// GEN counts the times a gateway opened the ring. When the file has the
+// same layout, a restarted gateway keeps HEAD, the records and the cursors,
+// so readers carry on. Otherwise it resets the ring, and readers see GEN
+// change with HEAD behind their position. The file is never resized in
+// place: a file of another size is replaced by a new one at the same path,
+// and MAGIC of the old one is cleared to tell readers to open the path
+// again.
+//
+// A cursor belongs to the reader holding a write lock (fcntl) on its bytes,
+// which is released when the reader exits. The reader stores its pid in
+// OWNER and advances POSITION, the next record it will read, so the gateway
+// can report how far each reader lags behind.
+//
+// Each slot is a seqlock around one record:
+// +---------+--------+------+-----+--------+---------+-------------+---------+
+// | LOCK(4) | LEN(2) | KIND | BUS | SEQ(8) | TIME(4) | RESERVED(4) | DATA... |
+// +---------+--------+------+-----+--------+---------+-------------+---------+
+// LOCK is odd while the slot is written. A reader takes LOCK, uses the
+// record in place, and checks that LOCK is unchanged and SEQ is the record
+// it expected, otherwise the writer has lapped it. TIME is micros() when the
+// frame completed, or when the register was updated.
+static const uint32_t SHARED_RING_MAGIC = 0x5247574E; /* "NGWR" */
+static const uint16_t SHARED_RING_VERSION = 1;
+
+enum shared_ring_record_type : uint8_t {
+  SHARED_RING_FRAME = 1,    /* DATA is the frame as sent to udp targets */
+  SHARED_RING_REGISTER = 2, /* DATA is ADDRESS(2) VALUE(4) of a decoded register */
+};
+
+struct shared_ring_header_type {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t slot_size;
+  uint32_t slot_count;
+  uint32_t reader_count;
+  std::atomic<uint64_t> head;
+  std::atomic<uint32_t> generation;
+  uint8_t reserved[36];
+};
+
+struct shared_ring_cursor_type {
+  std::atomic<uint32_t> owner; /* pid of the reader, 0 when never claimed */
+  uint32_t reserved0;
+  std::atomic<uint64_t> position;
+  std::atomic<uint64_t> lost; /* records the reader was lapped on */
+  uint8_t reserved[40];
+};
+
+struct shared_ring_slot_type {
+  std::atomic<uint32_t> lock;
+  uint16_t len;
+  uint8_t kind;
+  uint8_t bus;
+  uint64_t seq;
+  uint32_t time;
+  uint32_t reserved;
+  uint8_t data[MAX_DATA_LEN * 2];
+};
+
+static_assert(sizeof(shared_ring_header_type) == 64, "shared ring header layout");
+static_assert(sizeof(shared_ring_cursor_type) == 64, "shared ring cursor layout");
+static_assert(sizeof(shared_ring_slot_type) == 24 + MAX_DATA_LEN * 2, "shared ring slot layout");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared ring needs lock free 64 bit atomics");
+
+class NibeGwSharedRing {
+ public:
+  NibeGwSharedRing(std::string path, uint32_t slots, uint32_t readers)
+      : path_(std::move(path)), slot_count_(slots), reader_count_(readers) {}
+  ~NibeGwSharedRing();
+
+  void set_report_interval(uint32_t interval) {
+    report_interval_ = interval;
+  }
+
+  // Create, resume or reset the file and map it, see GEN above.
+  bool open();
+
+  void write_frame(uint8_t bus, uint32_t time, const uint8_t *data, size_t len);
+  void write_register(uint16_t address, uint32_t value, uint32_t time);
+
+  // Log how far each reader is behind once per report interval.
+  void loop(uint32_t now);
+  void dump_config();
+
+ protected:
+  void write(shared_ring_record_type kind, uint8_t bus, uint32_t time, const uint8_t *data, size_t len);
+  int replace(int fd);
+  bool resumable() const;
+  void reset();
+  bool live_reader(uint32_t index, uint32_t &pid, uint64_t &behind, uint64_t &lost) const;
+  size_t size() const {
+    return sizeof(shared_ring_header_type) + reader_count_ * sizeof(shared_ring_cursor_type) +
+           (size_t) slot_count_ * sizeof(shared_ring_slot_type);
+  }
+
+  std::string path_;
+  uint32_t slot_count_;
+  uint32_t reader_count_;
+  uint32_t report_interval_ = 60 * 1000;
+  uint32_t report_last_ = 0;
+  uint64_t lost_ = 0; /* sum of the lost counts of live readers at the last report */
+
+  uint8_t *map_ = nullptr;
+  shared_ring_header_type *header_ = nullptr;
+  shared_ring_cursor_type *cursors_ = nullptr;
+  shared_ring_slot_type *slots_ = nullptr;
+  uint64_t next_ = 0;
+};
+
+}  // namespace nibegw
+}  // namespace esphome
+
+#endif
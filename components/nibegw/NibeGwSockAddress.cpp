@@ -72,5 +72,46 @@ std::string socket_address::str() const {
   return "";
 }
 
+socket_endpoint::socket_endpoint(const socket_address &from) {
+  if (from.storage.ss_family == AF_INET) {
+    const auto *addr = reinterpret_cast<const struct sockaddr_in *>(&from.storage);
+    family = AF_INET;
+    port = addr->sin_port;
+    std::memcpy(address, &addr->sin_addr, sizeof(addr->sin_addr));
+  }
+#if USE_NETWORK_IPV6
+  else if (from.storage.ss_family == AF_INET6) {
+    const auto *addr = reinterpret_cast<const struct sockaddr_in6 *>(&from.storage);
+    family = AF_INET6;
+    port = addr->sin6_port;
+    std::memcpy(address, &addr->sin6_addr, sizeof(addr->sin6_addr));
+  }
+#endif
+}
+
+void socket_endpoint::to_address(socket_address &to) const {
+  if (family == AF_INET) {
+    auto *addr = reinterpret_cast<struct sockaddr_in *>(&to.storage);
+    std::memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = port;
+    std::memcpy(&addr->sin_addr, address, sizeof(addr->sin_addr));
+    to.len = sizeof(*addr);
+    return;
+  }
+#if USE_NETWORK_IPV6
+  if (family == AF_INET6) {
+    auto *addr = reinterpret_cast<struct sockaddr_in6 *>(&to.storage);
+    std::memset(addr, 0, sizeof(*addr));
+    addr->sin6_family = AF_INET6;
+    addr->sin6_port = port;
+    std::memcpy(&addr->sin6_addr, address, sizeof(addr->sin6_addr));
+    to.len = sizeof(*addr);
+    return;
+  }
+#endif
+  to.len = 0;
+}
+
 }  // namespace nibegw
 }  // namespace esphome
@@ -119,5 +119,38 @@ struct socket_address {
   }
 };
 
+// Compact IPv4/IPv6 endpoint, 20 bytes instead of a full sockaddr_storage.
+// Ordered by family, address and port for use in sorted tables.
+struct socket_endpoint {
+  uint8_t family = 0;
+  uint16_t port = 0;        /* network byte order */
+  uint8_t address[16] = {}; /* IPv4 uses the first 4 bytes */
+
+  socket_endpoint() = default;
+  explicit socket_endpoint(const socket_address &from);
+
+  // Fill in a socket address for sendto and logging.
+  void to_address(socket_address &to) const;
+
+  std::string str() const {
+    socket_address to;
+    to_address(to);
+    return to.str();
+  }
+
+  bool operator==(const socket_endpoint &other) const {
+    return family == other.family && port == other.port && std::memcmp(address, other.address, sizeof(address)) == 0;
+  }
+
+  bool operator<(const socket_endpoint &other) const {
+    if (family != other.family)
+      return family < other.family;
+    int cmp = std::memcmp(address, other.address, sizeof(address));
+    if (cmp != 0)
+      return cmp < 0;
+    return ntohs(port) < ntohs(other.port);
+  }
+};
+
 }  // namespace nibegw
 }  // namespace esphome
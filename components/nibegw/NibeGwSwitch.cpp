@@ -0,0 +1,46 @@
+#include <cmath>
+
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+#include "NibeGwSwitch.h"
+#include "NibeGwComponent.h"
+
+namespace esphome {
+namespace nibegw {
+
+static const char *TAG = "nibegw.switch";
+
+void NibeGwSwitch::setup() {
+  auto &registers = this->gw_->registers();
+  registers.add_listener(this->address_, [this](const register_entry_type &entry) { this->handle_register(entry); });
+  if (auto *entry = registers.find(this->address_)) {
+    this->handle_register(*entry);
+  }
+}
+
+void NibeGwSwitch::handle_register(const register_entry_type &entry) {
+  /* anything but the off value counts as on */
+  float value = get_register_value(entry.value, this->type_);
+  if (!std::isnan(value)) {
+    this->publish_state((int32_t) value != this->off_value_);
+  }
+}
+
+void NibeGwSwitch::write_state(bool state) {
+  uint32_t raw = set_register_value(state ? this->on_value_ : this->off_value_, 1.0, this->type_);
+  ESP_LOGD(TAG, "'%s': writing %s -> 0x%08X", this->get_name().c_str(), ONOFF(state), (unsigned) raw);
+  this->gw_->write_register(this->address_, raw, [this](request_status_type status, const uint8_t *data, int len) {
+    if (status != REQUEST_STATUS_OK) {
+      ESP_LOGW(TAG, "'%s': write failed: %d", this->get_name().c_str(), status);
+    }
+  });
+}
+
+void NibeGwSwitch::dump_config() {
+  LOG_SWITCH("", "NibeGw Register Switch", this);
+  ESP_LOGCONFIG(TAG, "  Register: %u", this->address_);
+}
+
+}  // namespace nibegw
+}  // namespace esphome
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+
+#include "esphome/core/component.h"
+#include "esphome/components/switch/switch.h"
+
+#include "NibeGwCodec.h"
+#include "NibeGwRegisters.h"
+
+namespace esphome {
+namespace nibegw {
+
+class NibeGwComponent;
+
+// Exposes a pump register as a switch, on and off map to configured raw values.
+class NibeGwSwitch : public switch_::Switch, public Component {
+ public:
+  void setup() override;
+  void dump_config() override;
+  void set_gw(NibeGwComponent *gw) {
+    this->gw_ = gw;
+  }
+  void set_register(uint16_t address) {
+    this->address_ = address;
+  }
+  void set_type(register_type type) {
+    this->type_ = type;
+  }
+  void set_on_value(int32_t value) {
+    this->on_value_ = value;
+  }
+  void set_off_value(int32_t value) {
+    this->off_value_ = value;
+  }
+
+ protected:
+  void write_state(bool state) override;
+  void handle_register(const register_entry_type &entry);
+
+  NibeGwComponent *gw_{nullptr};
+  uint16_t address_;
+  register_type type_{REGISTER_TYPE_U8};
+  int32_t on_value_{1};
+  int32_t off_value_{0};
+};
+
+}  // namespace nibegw
+}  // namespace esphome
@@ -0,0 +1,236 @@
+#include "NibeGwTcpServer.h"
+#include "NibeGw.h"
+
+#include <algorithm>
+
+namespace esphome {
+
+namespace nibegw {
+
+static const size_t TCP_RECORD_HEADER_LEN = 3;
+static const size_t TCP_REQUEST_HEADER_LEN = 5;
+static const size_t TCP_RECORD_MAX_LEN = TCP_RECORD_HEADER_LEN + TCP_REQUEST_HEADER_LEN + MAX_DATA_LEN;
+
+void NibeGwTcpServer::start() {
+  if (listen_) {
+    return;
+  }
+
+  listen_ = socket::socket_ip_loop_monitored(SOCK_STREAM, 0);
+  if (!listen_) {
+    ESP_LOGE(TAG, "Failed to create socket, error: %d", errno);
+    return;
+  }
+
+  int enable = 1;
+  listen_->setsockopt(SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  listen_->setblocking(false);
+
+  socket_address address(port_);
+  if (listen_->bind((sockaddr *) &address.storage, address.len) < 0) {
+    ESP_LOGE(TAG, "Failed to bind socket to port %d, error: %d", port_, errno);
+    listen_.reset();
+    return;
+  }
+
+  if (listen_->listen(max_clients_) < 0) {
+    ESP_LOGE(TAG, "Failed to listen on port %d, error: %d", port_, errno);
+    listen_.reset();
+    return;
+  }
+  ESP_LOGI(TAG, "TCP socket listening on port %d", port_);
+}
+
+void NibeGwTcpServer::stop() {
+  if (!listen_) {
+    return;
+  }
+  for (auto &client : clients_) {
+    close_client(client, "server stopped");
+  }
+  clients_.clear();
+  listen_.reset();
+  ESP_LOGI(TAG, "TCP socket released for port %d", port_);
+}
+
+void NibeGwTcpServer::dump_config() {
+  ESP_LOGCONFIG(TAG, " TCP Port: %d Clients: %zu/%zu Buffer: %zu", port_, clients_.size(), max_clients_,
+                buffer_size_);
+  for (auto &client : clients_) {
+    ESP_LOGCONFIG(TAG, "  Client: %s", client.peer.str().c_str());
+  }
+}
+
+void NibeGwTcpServer::accept_clients() {
+  if (!listen_->ready()) {
+    return;
+  }
+
+  while (true) {
+    socket_address peer;
+    auto socket = listen_->accept((sockaddr *) &peer.storage, &peer.len);
+    if (!socket) {
+      return;
+    }
+
+    if (clients_.size() >= max_clients_) {
+      ESP_LOGW(TAG, "Rejected client %s, too many clients", peer.str().c_str());
+      continue;
+    }
+    if (accept_handler_ && !accept_handler_(peer)) {
+      ESP_LOGW(TAG, "Rejected client %s, source not allowed", peer.str().c_str());
+      continue;
+    }
+
+    int enable = 1;
+    socket->setsockopt(IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    socket->setblocking(false);
+
+    client_type client;
+    client.id = next_id_++;
+    client.socket = std::move(socket);
+    client.peer = peer;
+    client.rx.reserve(TCP_RECORD_MAX_LEN);
+    client.tx.reserve(buffer_size_);
+    ESP_LOGI(TAG, "New client %s", client.peer.str().c_str());
+    clients_.push_back(std::move(client));
+  }
+}
+
+bool NibeGwTcpServer::read_client(client_type &client) {
+  uint8_t buf[TCP_RECORD_MAX_LEN];
+
+  while (true) {
+    ssize_t n = client.socket->read(buf, sizeof(buf));
+    if (n == 0) {
+      close_client(client, "closed by peer");
+      return false;
+    }
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return true;
+      }
+      close_client(client, "read error");
+      return false;
+    }
+
+    client.rx.insert(client.rx.end(), buf, buf + n);
+
+    size_t offset = 0;
+    while (client.rx.size() - offset >= TCP_RECORD_HEADER_LEN) {
+      const uint8_t *record = &client.rx[offset];
+      size_t len = (record[0] << 8) | record[1];
+      if (len == 0 || len + 2 > TCP_RECORD_MAX_LEN) {
+        close_client(client, "invalid record length");
+        return false;
+      }
+      if (client.rx.size() - offset < len + 2) {
+        break;
+      }
+
+      uint8_t type = record[2];
+      const uint8_t *body = &record[3];
+      size_t body_len = len - 1;
+      if (type != TCP_RECORD_REQUEST || body_len < TCP_REQUEST_HEADER_LEN) {
+        close_client(client, "invalid record");
+        return false;
+      }
+
+      if (request_handler_) {
+        uint16_t seq = (body[0] << 8) | body[1];
+        uint16_t address = (body[2] << 8) | body[3];
+        uint8_t token = body[4];
+        request_handler_(client.id, client.peer, seq, address, token, &body[TCP_REQUEST_HEADER_LEN],
+                         body_len - TCP_REQUEST_HEADER_LEN);
+        /* a reply queued by the handler may have overflowed the send buffer and closed the client */
+        if (!client.socket) {
+          return false;
+        }
+      }
+      offset += len + 2;
+    }
+    client.rx.erase(client.rx.begin(), client.rx.begin() + offset);
+  }
+}
+
+bool NibeGwTcpServer::write_client(client_type &client) {
+  if (client.tx.empty()) {
+    return true;
+  }
+
+  ssize_t n = client.socket->write(client.tx.data(), client.tx.size());
+  if (n < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return true;
+    }
+    close_client(client, "write error");
+    return false;
+  }
+  client.tx.erase(client.tx.begin(), client.tx.begin() + n);
+  return true;
+}
+
+bool NibeGwTcpServer::queue_record(client_type &client, uint8_t type, const uint8_t *head, size_t head_len,
+                                   const uint8_t *data, size_t len) {
+  if (!client.socket) {
+    return false;
+  }
+
+  size_t record_len = 1 + head_len + len;
+  if (client.tx.size() + record_len + 2 > buffer_size_) {
+    close_client(client, "send buffer full");
+    return false;
+  }
+
+  client.tx.push_back(record_len >> 8);
+  client.tx.push_back(record_len & 0xff);
+  client.tx.push_back(type);
+  client.tx.insert(client.tx.end(), head, head + head_len);
+  client.tx.insert(client.tx.end(), data, data + len);
+  return true;
+}
+
+void NibeGwTcpServer::close_client(client_type &client, const char *reason) {
+  if (!client.socket) {
+    return;
+  }
+  ESP_LOGI(TAG, "Client %s disconnected: %s", client.peer.str().c_str(), reason);
+  client.socket->close();
+  client.socket.reset();
+}
+
+void NibeGwTcpServer::send_frame(const uint8_t *data, size_t len) {
+  for (auto &client : clients_) {
+    queue_record(client, TCP_RECORD_FRAME, nullptr, 0, data, len);
+  }
+}
+
+void NibeGwTcpServer::send_reply(uint32_t id, uint16_t seq, uint8_t status, const uint8_t *data, size_t len) {
+  auto it = std::find_if(clients_.begin(), clients_.end(), [&](const auto &client) { return client.id == id; });
+  if (it == clients_.end()) {
+    ESP_LOGD(TAG, "Reply %d dropped, client gone", seq);
+    return;
+  }
+
+  const uint8_t head[] = {(uint8_t) (seq >> 8), (uint8_t) (seq & 0xff), status};
+  queue_record(*it, TCP_RECORD_REPLY, head, sizeof(head), data, len);
+}
+
+void NibeGwTcpServer::loop() {
+  if (!listen_) {
+    return;
+  }
+
+  accept_clients();
+
+  for (auto &client : clients_) {
+    if (client.socket && read_client(client)) {
+      write_client(client);
+    }
+  }
+
+  std::erase_if(clients_, [](const auto &client) { return !client.socket; });
+}
+
+}  // namespace nibegw
+}  // namespace esphome
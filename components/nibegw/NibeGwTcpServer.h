@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "esphome/core/log.h"
+#include "esphome/components/socket/socket.h"
+
+#include "NibeGwSockAddress.h"
+
+namespace esphome {
+namespace nibegw {
+
+// Record format on the TCP stream, all integers are big endian:
+// +--------+--------+------+---------+
+// | LEN_HI | LEN_LO | TYPE | BODY... |
+// +--------+--------+------+---------+
+//          |------ LEN ------------|
+//
+//  FRAME   (gw -> client): raw bus bytes as received.
+//  REQUEST (client -> gw): SEQ(2) ADDR(2) TOKEN(1) slave frame (C0 ...).
+//  REPLY   (gw -> client): SEQ(2) STATUS(1) frame answering the request, if any.
+enum tcp_record_type : uint8_t {
+  TCP_RECORD_FRAME = 0x01,
+  TCP_RECORD_REQUEST = 0x02,
+  TCP_RECORD_REPLY = 0x03,
+};
+
+typedef std::function<void(uint32_t client, const socket_address &peer, uint16_t seq, uint16_t address, uint8_t token,
+                           const uint8_t *data, size_t len)>
+    tcp_request_handler_type;
+typedef std::function<bool(const socket_address &peer)> tcp_accept_handler_type;
+
+class NibeGwTcpServer {
+  struct client_type {
+    uint32_t id;
+    std::unique_ptr<socket::Socket> socket;
+    socket_address peer;
+    std::vector<uint8_t> rx;
+    std::vector<uint8_t> tx;
+  };
+
+  const char *TAG = "nibegw.tcp";
+  int port_;
+  size_t max_clients_;
+  size_t buffer_size_;
+  uint32_t next_id_ = 1;
+  std::unique_ptr<socket::Socket> listen_;
+  std::vector<client_type> clients_;
+  tcp_request_handler_type request_handler_;
+  tcp_accept_handler_type accept_handler_;
+
+  void accept_clients();
+  bool read_client(client_type &client);
+  bool write_client(client_type &client);
+  bool queue_record(client_type &client, uint8_t type, const uint8_t *head, size_t head_len, const uint8_t *data,
+                    size_t len);
+  void close_client(client_type &client, const char *reason);
+
+ public:
+  NibeGwTcpServer(int port, size_t max_clients, size_t buffer_size)
+      : port_(port), max_clients_(max_clients), buffer_size_(buffer_size) {}
+
+  void set_request_handler(tcp_request_handler_type handler) {
+    request_handler_ = std::move(handler);
+  }
+
+  // Asked for every new connection, a peer it refuses is closed right away.
+  void set_accept_handler(tcp_accept_handler_type handler) {
+    accept_handler_ = std::move(handler);
+  }
+
+  void start();
+  void stop();
+  void loop();
+  void dump_config();
+
+  // Queue a bus frame to every connected client.
+  void send_frame(const uint8_t *data, size_t len);
+
+  // Queue a reply to a request previously received from client. Dropped if
+  // the client has since disconnected.
+  void send_reply(uint32_t client, uint16_t seq, uint8_t status, const uint8_t *data, size_t len);
+};
+
+}  // namespace nibegw
+}  // namespace esphome
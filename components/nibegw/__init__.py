@@ -1,23 +1,36 @@
+import ipaddress
 from operator import xor
 from functools import reduce
 
 import esphome.config_validation as cv
 import esphome.codegen as cg
+import esphome.final_validate as fv
 from esphome.const import (
     CONF_ID,
+    CONF_PATH,
+    CONF_PLATFORM,
     CONF_PORT,
+    CONF_UART_ID,
+    PLATFORM_HOST,
 )
 from esphome import pins
 from esphome.components.network import IPAddress
 from enum import IntEnum, Enum
 from esphome.components import uart, socket
 from esphome.types import ConfigType
+from esphome.core import ID
 
 AUTO_LOAD = ["sensor", "climate"]
 DEPENDENCIES = ["logger"]
 
 nibegw_ns = cg.esphome_ns.namespace("nibegw")
 NibeGwComponent = nibegw_ns.class_("NibeGwComponent", cg.Component, uart.UARTDevice)
+RegisterType = nibegw_ns.enum("register_type")
+RuleOp = nibegw_ns.enum("rule_op_type")
+RuleAction = nibegw_ns.enum("rule_action_type")
+RuleType = nibegw_ns.struct("rule_type")
+RouteType = nibegw_ns.struct("route_type")
+ConstantRouteType = nibegw_ns.struct("constant_route_type")
 
 CONF_DIR_PIN = "dir_pin"
 CONF_TARGET = "target"
@@ -38,6 +51,50 @@ CONF_TOKEN = "token"
 CONF_COMMAND = "command"
 CONF_DATA = "data"
 CONF_CONSTANTS = "constants"
+CONF_TCP = "tcp"
+CONF_MAX_CLIENTS = "max_clients"
+CONF_BUFFER_SIZE = "buffer_size"
+CONF_INTER_BYTE_TIMEOUT = "inter_byte_timeout"
+CONF_STATUS_REPLIES = "status_replies"
+CONF_RETRY_BUDGET = "retry_budget"
+CONF_REGISTERS = "registers"
+CONF_CAPACITY = "capacity"
+CONF_SNAPSHOT_INTERVAL = "snapshot_interval"
+CONF_SCAN = "scan"
+CONF_POLL = "poll"
+CONF_REGISTER = "register"
+CONF_PERIOD = "period"
+CONF_TYPE = "type"
+CONF_AGGREGATE = "aggregate"
+CONF_WINDOW = "window"
+CONF_RULES = "rules"
+CONF_FACTOR = "factor"
+CONF_BELOW = "below"
+CONF_ABOVE = "above"
+CONF_HYSTERESIS = "hysteresis"
+CONF_WRITE = "write"
+CONF_SETPOINT = "setpoint"
+CONF_SYSTEM = "system"
+CONF_VALUE = "value"
+CONF_RELEASE = "release"
+CONF_FRAME_POOL = "frame_pool"
+CONF_STATS_INTERVAL = "stats_interval"
+CONF_RATE = "rate"
+CONF_MEMORY = "memory"
+CONF_ENVELOPE = "envelope"
+CONF_MAX_TARGETS = "max_targets"
+CONF_MAX_QUEUES = "max_queues"
+CONF_BURST = "burst"
+CONF_BUSES = "buses"
+CONF_BUS = "bus"
+CONF_LOAD_SHEDDING = "load_shedding"
+CONF_RESPONSE_DEADLINE = "response_deadline"
+CONF_MIN_SLACK = "min_slack"
+CONF_HOLD = "hold"
+CONF_SHARED_RING = "shared_ring"
+CONF_SLOTS = "slots"
+CONF_READERS = "readers"
+CONF_REPORT_INTERVAL = "report_interval"
 
 
 class Addresses(IntEnum):
@@ -76,10 +133,53 @@ def _consume_nibegw_sockets(config: ConfigType) -> ConfigType:
     # MQTT needs 1 socket for the broker connection
     udp = config[CONF_UDP]
     socket_count = len(udp[CONF_PORTS])
+    if tcp := config.get(CONF_TCP):
+        socket_count += 1 + tcp[CONF_MAX_CLIENTS]
     socket.consume_sockets(socket_count, "nibegw")(config)
     return config
 
 
+def _validate_buses(config: ConfigType) -> ConfigType:
+    buses = {0}
+    for bus in config[CONF_BUSES]:
+        if bus[CONF_BUS] in buses:
+            raise cv.Invalid(f"Bus {bus[CONF_BUS]} is defined more than once")
+        buses.add(bus[CONF_BUS])
+
+    for item in config[CONF_UDP][CONF_PORTS] + config[CONF_CONSTANTS]:
+        if item[CONF_BUS] not in buses:
+            raise cv.Invalid(f"Bus {item[CONF_BUS]} is not defined in {CONF_BUSES}")
+    return config
+
+
+def _validate_status_replies(config: ConfigType) -> ConfigType:
+    # Without a source list any spoofed sender address would be answered,
+    # and the gateway could be used to reflect traffic.
+    if config[CONF_STATUS_REPLIES] and not config[CONF_SOURCE]:
+        raise cv.Invalid(
+            f"{CONF_STATUS_REPLIES} requires a {CONF_SOURCE} list",
+            [CONF_STATUS_REPLIES],
+        )
+    return config
+
+
+def bus_id(value) -> int:
+    """Id of an additional bus, tagged frames carry it in place of the second byte."""
+    value = cv.int_range(min=1, max=255)(value)
+    if value == 0x5C:
+        raise cv.Invalid("Bus id 0x5C is the frame start byte and can't be used")
+    return value
+
+
+def enum_int(value) -> int:
+    return int(getattr(value, "enum_value", value))
+
+
+def bus_address(bus: int, address) -> int:
+    """Address key of an address on a bus, the bus id is the high byte."""
+    return (bus << 8) | enum_int(address)
+
+
 def _upgrade_ports(config: ConfigType) -> ConfigType:
     udp = config[CONF_UDP]
     if port_number := udp[CONF_WRITE_PORT]:
@@ -114,6 +214,7 @@ CONSTANTS_SCHEMA = cv.Schema(
         cv.Required(CONF_TOKEN): cv.Any(real_enum(Token), int),
         cv.Optional(CONF_COMMAND): cv.Any(real_enum(Token), int),
         cv.Required(CONF_DATA): [int],
+        cv.Optional(CONF_BUS, default=0): cv.uint8_t,
     }
 )
 
@@ -124,21 +225,198 @@ TARGET_SCHEMA = cv.Schema(
     }
 )
 
+UDP_TARGET_SCHEMA = TARGET_SCHEMA.extend(
+    {
+        cv.Optional(CONF_ENVELOPE): cv.boolean,
+    }
+)
+
 PORTS_SCHEMA = cv.Schema(
     {
         cv.Required(CONF_PORT): cv.port,
         cv.Required(CONF_ADDRESS): cv.Any(real_enum(Addresses), int),
         cv.Required(CONF_TOKEN): cv.Any(real_enum(Token), int),
+        cv.Optional(CONF_BUS, default=0): cv.uint8_t,
+    }
+)
+
+
+def ipv4_network(value):
+    """An IPv4 address, or a prefix in CIDR notation."""
+    value = cv.string_strict(value)
+    try:
+        return ipaddress.IPv4Network(value, strict=False)
+    except ValueError as err:
+        raise cv.Invalid(f"{value} is not a valid IPv4 address or prefix: {err}")
+
+
+SOURCE_SCHEMA = cv.Any(
+    cv.Schema(
+        {
+            cv.Required(CONF_ADDRESS): ipv4_network,
+            cv.Optional(CONF_RATE, default=0): cv.int_range(min=0, max=1000),
+            cv.Optional(CONF_BURST): cv.int_range(min=1, max=1000),
+        }
+    ),
+    cv.All(ipv4_network, lambda value: {CONF_ADDRESS: value, CONF_RATE: 0}),
+)
+
+
+MEMORY_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_MAX_TARGETS, default=32): cv.int_range(min=1, max=255),
+        cv.Optional(CONF_MAX_QUEUES, default=64): cv.int_range(min=1, max=1024),
+    }
+)
+
+SHARED_RING_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.Optional(CONF_PATH, default="/dev/shm/nibegw"): cv.string_strict,
+            cv.Optional(CONF_SLOTS, default=4096): cv.int_range(min=16, max=1 << 20),
+            cv.Optional(CONF_READERS, default=8): cv.int_range(min=1, max=64),
+            cv.Optional(
+                CONF_REPORT_INTERVAL, default="60s"
+            ): cv.positive_time_period_milliseconds,
+        }
+    ),
+    cv.only_on(PLATFORM_HOST),
+)
+
+
+UDP_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.Optional(CONF_TARGET, []): cv.ensure_list(UDP_TARGET_SCHEMA),
+            cv.Optional(CONF_READ_PORT, default=9999): cv.port,
+            cv.Optional(CONF_WRITE_PORT, default=10000): cv.port,
+            cv.Optional(CONF_SOURCE, []): cv.ensure_list(SOURCE_SCHEMA),
+            cv.Optional(CONF_PORTS, []): cv.ensure_list(PORTS_SCHEMA),
+            cv.Optional(CONF_STATUS_REPLIES, default=False): cv.boolean,
+            cv.Optional(CONF_ENVELOPE, default=False): cv.boolean,
+        }
+    ),
+    _validate_status_replies,
+)
+
+TCP_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_PORT, default=9998): cv.port,
+        cv.Optional(CONF_MAX_CLIENTS, default=4): cv.int_range(min=1, max=8),
+        cv.Optional(CONF_BUFFER_SIZE, default=2048): cv.int_range(min=256, max=16384),
+    }
+)
+
+LOAD_SHEDDING_SCHEMA = cv.Schema(
+    {
+        cv.Optional(
+            CONF_RESPONSE_DEADLINE, default="20ms"
+        ): cv.positive_time_period_microseconds,
+        cv.Optional(
+            CONF_MIN_SLACK, default="5ms"
+        ): cv.positive_time_period_microseconds,
+        cv.Optional(CONF_HOLD, default="1s"): cv.positive_time_period_milliseconds,
+    }
+)
+
+REGISTERS_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_CAPACITY, default=64): cv.int_range(min=1, max=64),
+        cv.Optional(CONF_SNAPSHOT_INTERVAL): cv.All(
+            cv.positive_time_period_milliseconds,
+            cv.Range(min=cv.TimePeriod(minutes=1)),
+        ),
+    }
+)
+
+SCAN_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_REGISTERS): cv.All(
+            cv.ensure_list(cv.int_range(min=0, max=0xFFFE)), cv.Length(min=1)
+        ),
+    }
+)
+
+REGISTER_TYPES = {
+    "u8": RegisterType.REGISTER_TYPE_U8,
+    "s8": RegisterType.REGISTER_TYPE_S8,
+    "u16": RegisterType.REGISTER_TYPE_U16,
+    "s16": RegisterType.REGISTER_TYPE_S16,
+    "u32": RegisterType.REGISTER_TYPE_U32,
+    "s32": RegisterType.REGISTER_TYPE_S32,
+}
+
+AGGREGATE_REGISTER_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_REGISTER): cv.int_range(min=0, max=0xFFFE),
+        cv.Optional(CONF_TYPE, default="s16"): cv.enum(REGISTER_TYPES, lower=True),
+    }
+)
+
+AGGREGATE_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_WINDOW, default="1min"): cv.All(
+            cv.positive_time_period_milliseconds,
+            cv.Range(min=cv.TimePeriod(seconds=1), max=cv.TimePeriod(hours=18)),
+        ),
+        cv.Required(CONF_REGISTERS): cv.All(
+            cv.ensure_list(AGGREGATE_REGISTER_SCHEMA), cv.Length(min=1, max=32)
+        ),
+        cv.Required(CONF_TARGET): cv.ensure_list(TARGET_SCHEMA),
+    }
+)
+
+RULE_WRITE_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_REGISTER): cv.int_range(min=0, max=0xFFFE),
+        cv.Required(CONF_VALUE): cv.int_range(min=-(2**24), max=2**24),
+        cv.Optional(CONF_RELEASE): cv.int_range(min=-(2**24), max=2**24),
     }
 )
 
-UDP_SCHEMA = cv.Schema(
+RULE_SETPOINT_SCHEMA = cv.Schema(
     {
-        cv.Optional(CONF_TARGET, []): cv.ensure_list(TARGET_SCHEMA),
-        cv.Optional(CONF_READ_PORT, default=9999): cv.port,
-        cv.Optional(CONF_WRITE_PORT, default=10000): cv.port,
-        cv.Optional(CONF_SOURCE, []): cv.ensure_list(cv.ipv4address),
-        cv.Optional(CONF_PORTS, []): cv.ensure_list(PORTS_SCHEMA),
+        cv.Required(CONF_SYSTEM): cv.int_range(min=1, max=4),
+        cv.Required(CONF_VALUE): cv.float_range(min=5.0, max=30.5),
+        cv.Optional(CONF_RELEASE): cv.float_range(min=5.0, max=30.5),
+    }
+)
+
+RULE_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.Required(CONF_REGISTER): cv.int_range(min=0, max=0xFFFE),
+            cv.Optional(CONF_TYPE, default="s16"): cv.enum(REGISTER_TYPES, lower=True),
+            cv.Optional(CONF_FACTOR, default=1.0): cv.float_,
+            cv.Exclusive(CONF_BELOW, "op"): cv.float_,
+            cv.Exclusive(CONF_ABOVE, "op"): cv.float_,
+            cv.Optional(CONF_HYSTERESIS, default=0.0): cv.positive_float,
+            cv.Exclusive(CONF_WRITE, "action"): RULE_WRITE_SCHEMA,
+            cv.Exclusive(CONF_SETPOINT, "action"): RULE_SETPOINT_SCHEMA,
+        }
+    ),
+    cv.has_exactly_one_key(CONF_BELOW, CONF_ABOVE),
+    cv.has_exactly_one_key(CONF_WRITE, CONF_SETPOINT),
+)
+
+POLL_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_REGISTER): cv.int_range(min=0, max=0xFFFE),
+        cv.Required(CONF_PERIOD): cv.All(
+            cv.positive_time_period_milliseconds,
+            cv.Range(min=cv.TimePeriod(milliseconds=100)),
+        ),
+    }
+)
+
+BUS_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_BUS): bus_id,
+        cv.Required(CONF_UART_ID): cv.use_id(uart.UARTComponent),
+        cv.Optional(CONF_DIR_PIN): pins.gpio_output_pin_schema,
+        cv.Optional(CONF_ACKNOWLEDGE, default=[]): [
+            cv.Any(addresses_string, cv.Coerce(int))
+        ],
     }
 )
 
@@ -150,17 +428,90 @@ CONFIG_SCHEMA = cv.All(
                 cv.Any(addresses_string, cv.Coerce(int))
             ],
             cv.Required(CONF_UDP): UDP_SCHEMA,
+            cv.Optional(CONF_TCP): TCP_SCHEMA,
             cv.Optional(CONF_DIR_PIN): pins.gpio_output_pin_schema,
             cv.Optional(CONF_CONSTANTS, default=[]): cv.ensure_list(CONSTANTS_SCHEMA),
+            cv.Optional(
+                CONF_RETRY_BUDGET, default="5s"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_LOAD_SHEDDING): LOAD_SHEDDING_SCHEMA,
+            cv.Optional(CONF_REGISTERS): REGISTERS_SCHEMA,
+            cv.Optional(CONF_SCAN): SCAN_SCHEMA,
+            cv.Optional(CONF_POLL): cv.ensure_list(POLL_SCHEMA),
+            cv.Optional(CONF_AGGREGATE): AGGREGATE_SCHEMA,
+            cv.Optional(CONF_RULES): cv.ensure_list(RULE_SCHEMA),
+            cv.Optional(CONF_BUSES, default=[]): cv.ensure_list(BUS_SCHEMA),
+            cv.Optional(CONF_FRAME_POOL, default=16): cv.int_range(min=4, max=255),
+            cv.Optional(CONF_MEMORY, default={}): MEMORY_SCHEMA,
+            cv.Optional(CONF_SHARED_RING): SHARED_RING_SCHEMA,
+            cv.Optional(CONF_STATS_INTERVAL): cv.All(
+                cv.positive_time_period_milliseconds,
+                cv.Range(min=cv.TimePeriod(seconds=1)),
+            ),
+            cv.Optional(CONF_INTER_BYTE_TIMEOUT): cv.All(
+                cv.positive_time_period_microseconds,
+                cv.Range(min=cv.TimePeriod(microseconds=500)),
+            ),
         }
     )
     .extend(cv.COMPONENT_SCHEMA)
     .extend(uart.UART_DEVICE_SCHEMA),
     _upgrade_ports,
+    _validate_buses,
     _consume_nibegw_sockets,
 )
 
 
+def _final_validate_rules(config: ConfigType) -> ConfigType:
+    # A set point is sent through the RMU40 emulation of a climate, without
+    # one for the system the pump is never asked for it.
+    systems = {
+        climate_config[CONF_SYSTEM]
+        for climate_config in fv.full_config.get().get("climate", [])
+        if climate_config.get(CONF_PLATFORM) == "nibegw"
+        and str(climate_config.get("gateway")) == str(config[CONF_ID])
+    }
+    for index, rule in enumerate(config.get(CONF_RULES, [])):
+        setpoint = rule.get(CONF_SETPOINT)
+        if setpoint and setpoint[CONF_SYSTEM] not in systems:
+            raise cv.Invalid(
+                f"No nibegw climate for system {setpoint[CONF_SYSTEM]}, the set point would never be sent",
+                path=[CONF_RULES, index, CONF_SETPOINT, CONF_SYSTEM],
+            )
+    return config
+
+
+FINAL_VALIDATE_SCHEMA = _final_validate_rules
+
+
+def rule_to_struct(rule):
+    if CONF_BELOW in rule:
+        op, threshold = RuleOp.RULE_OP_BELOW, rule[CONF_BELOW]
+    else:
+        op, threshold = RuleOp.RULE_OP_ABOVE, rule[CONF_ABOVE]
+
+    if write := rule.get(CONF_WRITE):
+        action, target = RuleAction.RULE_ACTION_WRITE, write[CONF_REGISTER]
+    else:
+        write = rule[CONF_SETPOINT]
+        action, target = RuleAction.RULE_ACTION_SETPOINT, write[CONF_SYSTEM] - 1
+
+    return cg.StructInitializer(
+        RuleType,
+        ("address", rule[CONF_REGISTER]),
+        ("type", rule[CONF_TYPE]),
+        ("op", op),
+        ("factor", rule[CONF_FACTOR]),
+        ("threshold", threshold),
+        ("hysteresis", rule[CONF_HYSTERESIS]),
+        ("action", action),
+        ("target", target),
+        ("value", float(write[CONF_VALUE])),
+        ("release", float(write.get(CONF_RELEASE, 0))),
+        ("has_release", CONF_RELEASE in write),
+    )
+
+
 async def to_code(config):
     if dir_pin := config.get(CONF_DIR_PIN):
         dir_pin_data = await cg.gpio_pin_expression(dir_pin)
@@ -178,23 +529,149 @@ async def to_code(config):
         for target in udp[CONF_TARGET]:
             cg.add(
                 var.add_target(
-                    IPAddress(str(target[CONF_TARGET_IP])), target[CONF_TARGET_PORT]
+                    IPAddress(str(target[CONF_TARGET_IP])),
+                    target[CONF_TARGET_PORT],
+                    target.get(CONF_ENVELOPE, udp[CONF_ENVELOPE]),
                 )
             )
 
-        for port in udp[CONF_PORTS]:
+        # Routes are looked up by binary search, so emit them sorted. A later
+        # port for the same address and token replaces an earlier one.
+        routes = {
+            (
+                bus_address(port[CONF_BUS], port[CONF_ADDRESS]),
+                enum_int(port[CONF_TOKEN]),
+            ): port[CONF_PORT]
+            for port in udp[CONF_PORTS]
+        }
+        if routes:
+            routes_array = cg.static_const_array(
+                ID(f"{config[CONF_ID]}_routes", is_declaration=True, type=RouteType),
+                [
+                    cg.StructInitializer(
+                        RouteType,
+                        ("address", address),
+                        ("token", token),
+                        ("port", port),
+                    )
+                    for (address, token), port in sorted(routes.items())
+                ],
+            )
+            cg.add(var.set_routes(routes_array, len(routes)))
+
+        for source in udp[CONF_SOURCE]:
+            network = source[CONF_ADDRESS]
             cg.add(
-                var.add_socket_request(
-                    port[CONF_ADDRESS], port[CONF_TOKEN], port[CONF_PORT]
+                var.add_source(
+                    IPAddress(str(network.network_address)),
+                    network.prefixlen,
+                    source[CONF_RATE],
+                    source.get(CONF_BURST, max(source[CONF_RATE], 1)),
                 )
             )
 
-        for source in udp[CONF_SOURCE]:
-            cg.add(var.add_source_ip(IPAddress(str(source))))
+        cg.add(var.set_status_replies(udp[CONF_STATUS_REPLIES]))
+        cg.add(var.set_envelope(udp[CONF_ENVELOPE]))
+
+    cg.add(var.set_retry_budget(config[CONF_RETRY_BUDGET].total_milliseconds))
+    cg.add(var.set_frame_pool(config[CONF_FRAME_POOL]))
+
+    memory = config[CONF_MEMORY]
+    cg.add(var.set_memory_caps(memory[CONF_MAX_TARGETS], memory[CONF_MAX_QUEUES]))
 
-    if config[CONF_ACKNOWLEDGE]:
-        for address in config[CONF_ACKNOWLEDGE]:
-            cg.add(var.add_acknowledge(address))
+    if ring := config.get(CONF_SHARED_RING):
+        cg.add(
+            var.set_shared_ring(
+                ring[CONF_PATH],
+                ring[CONF_SLOTS],
+                ring[CONF_READERS],
+                ring[CONF_REPORT_INTERVAL].total_milliseconds,
+            )
+        )
+
+    if stats_interval := config.get(CONF_STATS_INTERVAL):
+        cg.add(var.set_stats_interval(stats_interval.total_milliseconds))
+
+    if timeout := config.get(CONF_INTER_BYTE_TIMEOUT):
+        cg.add(var.set_inter_byte_timeout(timeout.total_microseconds))
+
+    if shedding := config.get(CONF_LOAD_SHEDDING):
+        cg.add(
+            var.set_load_shedding(
+                shedding[CONF_RESPONSE_DEADLINE].total_microseconds,
+                shedding[CONF_MIN_SLACK].total_microseconds,
+                shedding[CONF_HOLD].total_milliseconds,
+            )
+        )
+
+    if registers := config.get(CONF_REGISTERS):
+        snapshot_interval = registers.get(CONF_SNAPSHOT_INTERVAL)
+        cg.add(
+            var.set_registers(
+                registers[CONF_CAPACITY],
+                snapshot_interval.total_milliseconds if snapshot_interval else 0,
+            )
+        )
+
+    for poll in config.get(CONF_POLL, []):
+        cg.add(
+            var.add_poll_register(
+                poll[CONF_REGISTER], poll[CONF_PERIOD].total_milliseconds
+            )
+        )
+
+    for rule in config.get(CONF_RULES, []):
+        cg.add(var.add_rule(rule_to_struct(rule)))
+
+    if aggregate := config.get(CONF_AGGREGATE):
+        cg.add(var.set_aggregate_window(aggregate[CONF_WINDOW].total_milliseconds))
+        for register in aggregate[CONF_REGISTERS]:
+            cg.add(
+                var.add_aggregate_register(register[CONF_REGISTER], register[CONF_TYPE])
+            )
+        for target in aggregate[CONF_TARGET]:
+            cg.add(
+                var.add_aggregate_target(
+                    IPAddress(str(target[CONF_TARGET_IP])), target[CONF_TARGET_PORT]
+                )
+            )
+
+    if scan := config.get(CONF_SCAN):
+        for address in scan[CONF_REGISTERS]:
+            cg.add(var.add_scan_register(address))
+
+    if tcp := config.get(CONF_TCP):
+        cg.add(
+            var.set_tcp(tcp[CONF_PORT], tcp[CONF_MAX_CLIENTS], tcp[CONF_BUFFER_SIZE])
+        )
+
+    def acknowledge_mask(bus: int, addresses):
+        if not addresses:
+            return
+        mask = [0] * 32
+        for address in addresses:
+            address = enum_int(address)
+            mask[address >> 3] |= 1 << (address & 7)
+        mask_array = cg.progmem_array(
+            ID(
+                f"{config[CONF_ID]}_acknowledge_{bus}",
+                is_declaration=True,
+                type=cg.uint8,
+            ),
+            mask,
+        )
+        cg.add(var.set_acknowledge_mask(bus, mask_array))
+
+    acknowledge_mask(0, config[CONF_ACKNOWLEDGE])
+
+    for bus in config[CONF_BUSES]:
+        parent = await cg.get_variable(bus[CONF_UART_ID])
+        if dir_pin := bus.get(CONF_DIR_PIN):
+            bus_dir_pin = await cg.gpio_pin_expression(dir_pin)
+        else:
+            bus_dir_pin = 0
+        cg.add(var.add_bus(bus[CONF_BUS], parent, bus_dir_pin))
+        acknowledge_mask(bus[CONF_BUS], bus[CONF_ACKNOWLEDGE])
 
     def xor8(data: bytes) -> int:
         chksum = reduce(xor, data)
@@ -207,9 +684,45 @@ async def to_code(config):
         packet.append(xor8(packet))
         return packet
 
-    for request in config[CONF_CONSTANTS]:
-        data = generate_request(
+    # Constant frames are packed into one table, indexed by a sorted route
+    # table. A later constant for the same address and token replaces an
+    # earlier one.
+    constants = {
+        (
+            bus_address(request[CONF_BUS], request[CONF_ADDRESS]),
+            enum_int(request[CONF_TOKEN]),
+        ): generate_request(
             request.get(CONF_COMMAND, request[CONF_TOKEN]).enum_value,
             request[CONF_DATA],
         )
-        cg.add(var.set_request(request[CONF_ADDRESS], request[CONF_TOKEN], data))
+        for request in config[CONF_CONSTANTS]
+    }
+    if constants:
+        frames = []
+        constant_routes = []
+        for (address, token), data in sorted(constants.items()):
+            constant_routes.append(
+                cg.StructInitializer(
+                    ConstantRouteType,
+                    ("address", address),
+                    ("token", token),
+                    ("len", len(data)),
+                    ("offset", len(frames)),
+                )
+            )
+            frames.extend(data)
+        frames_array = cg.progmem_array(
+            ID(
+                f"{config[CONF_ID]}_constant_frames", is_declaration=True, type=cg.uint8
+            ),
+            frames,
+        )
+        constants_array = cg.static_const_array(
+            ID(
+                f"{config[CONF_ID]}_constants",
+                is_declaration=True,
+                type=ConstantRouteType,
+            ),
+            constant_routes,
+        )
+        cg.add(var.set_constants(constants_array, len(constant_routes), frames_array))
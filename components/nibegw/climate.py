@@ -10,17 +10,35 @@ NibeGwClimate = nibegw_ns.class_("NibeGwClimate", climate.Climate, cg.Component)
 
 CONF_GATEWAY = "gateway"
 CONF_SYSTEM = "system"
+CONF_HYSTERESIS = "hysteresis"
+CONF_MIN_INTERVAL = "min_interval"
+CONF_MAX_INTERVAL = "max_interval"
 
-CONFIG_SCHEMA = (
+
+def _validate_intervals(config):
+    if config[CONF_MIN_INTERVAL] > config[CONF_MAX_INTERVAL]:
+        raise cv.Invalid(f"{CONF_MIN_INTERVAL} must not exceed {CONF_MAX_INTERVAL}")
+    return config
+
+
+CONFIG_SCHEMA = cv.All(
     climate.climate_schema(NibeGwClimate)
     .extend(
         {
             cv.GenerateID(CONF_GATEWAY): cv.use_id(NibeGwComponent),
             cv.Required(CONF_SENSOR): cv.use_id(sensor.Sensor),
             cv.Required(CONF_SYSTEM): cv.int_range(min=1, max=4),
+            cv.Optional(CONF_HYSTERESIS, default=0.1): cv.float_range(min=0.0, max=5.0),
+            cv.Optional(
+                CONF_MIN_INTERVAL, default="1s"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(
+                CONF_MAX_INTERVAL, default="10s"
+            ): cv.positive_time_period_milliseconds,
         }
     )
-    .extend(cv.COMPONENT_SCHEMA)
+    .extend(cv.COMPONENT_SCHEMA),
+    _validate_intervals,
 )
 
 
@@ -30,6 +48,9 @@ async def to_code(config):
     gw = await cg.get_variable(config[CONF_GATEWAY])
     cg.add(var.set_gw(gw))
     cg.add(var.set_system(config[CONF_SYSTEM]))
+    cg.add(var.set_hysteresis(config[CONF_HYSTERESIS]))
+    cg.add(var.set_min_interval(config[CONF_MIN_INTERVAL].total_milliseconds))
+    cg.add(var.set_max_interval(config[CONF_MAX_INTERVAL].total_milliseconds))
 
     sens = await cg.get_variable(config[CONF_SENSOR])
     cg.add(var.set_sensor(sens))
@@ -0,0 +1,55 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import number
+from esphome.const import CONF_MIN_VALUE, CONF_MAX_VALUE, CONF_STEP
+from . import (
+    NibeGwComponent,
+    nibegw_ns,
+    REGISTER_TYPES,
+    CONF_REGISTER,
+    CONF_TYPE,
+    CONF_FACTOR,
+)
+
+NibeGwNumber = nibegw_ns.class_("NibeGwNumber", number.Number, cg.Component)
+
+CONF_GATEWAY = "gateway"
+
+
+def _validate_range(config):
+    if config[CONF_MIN_VALUE] > config[CONF_MAX_VALUE]:
+        raise cv.Invalid(f"{CONF_MIN_VALUE} must not exceed {CONF_MAX_VALUE}")
+    return config
+
+
+CONFIG_SCHEMA = cv.All(
+    number.number_schema(NibeGwNumber)
+    .extend(
+        {
+            cv.GenerateID(CONF_GATEWAY): cv.use_id(NibeGwComponent),
+            cv.Required(CONF_REGISTER): cv.int_range(min=0, max=0xFFFE),
+            cv.Optional(CONF_TYPE, default="s16"): cv.enum(REGISTER_TYPES, lower=True),
+            cv.Optional(CONF_FACTOR, default=1.0): cv.float_,
+            cv.Required(CONF_MIN_VALUE): cv.float_,
+            cv.Required(CONF_MAX_VALUE): cv.float_,
+            cv.Optional(CONF_STEP): cv.positive_float,
+        }
+    )
+    .extend(cv.COMPONENT_SCHEMA),
+    _validate_range,
+)
+
+
+async def to_code(config):
+    var = await number.new_number(
+        config,
+        min_value=config[CONF_MIN_VALUE],
+        max_value=config[CONF_MAX_VALUE],
+        step=config.get(CONF_STEP, config[CONF_FACTOR]),
+    )
+    await cg.register_component(var, config)
+    gw = await cg.get_variable(config[CONF_GATEWAY])
+    cg.add(var.set_gw(gw))
+    cg.add(var.set_register(config[CONF_REGISTER]))
+    cg.add(var.set_type(config[CONF_TYPE]))
+    cg.add(var.set_factor(config[CONF_FACTOR]))
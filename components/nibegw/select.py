@@ -0,0 +1,51 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import select
+from esphome.const import CONF_OPTIONS
+from . import (
+    NibeGwComponent,
+    nibegw_ns,
+    REGISTER_TYPES,
+    CONF_REGISTER,
+    CONF_TYPE,
+)
+
+NibeGwSelect = nibegw_ns.class_("NibeGwSelect", select.Select, cg.Component)
+
+CONF_GATEWAY = "gateway"
+
+
+def _validate_options(value):
+    value = cv.Schema({cv.string_strict: cv.int_range(min=-(2**31), max=2**31 - 1)})(
+        value
+    )
+    if not value:
+        raise cv.Invalid("At least one option is required")
+    if len(set(value.values())) != len(value):
+        raise cv.Invalid("Option values must be unique")
+    return value
+
+
+CONFIG_SCHEMA = (
+    select.select_schema(NibeGwSelect)
+    .extend(
+        {
+            cv.GenerateID(CONF_GATEWAY): cv.use_id(NibeGwComponent),
+            cv.Required(CONF_REGISTER): cv.int_range(min=0, max=0xFFFE),
+            cv.Optional(CONF_TYPE, default="u8"): cv.enum(REGISTER_TYPES, lower=True),
+            cv.Required(CONF_OPTIONS): _validate_options,
+        }
+    )
+    .extend(cv.COMPONENT_SCHEMA)
+)
+
+
+async def to_code(config):
+    options = config[CONF_OPTIONS]
+    var = await select.new_select(config, options=list(options.keys()))
+    await cg.register_component(var, config)
+    gw = await cg.get_variable(config[CONF_GATEWAY])
+    cg.add(var.set_gw(gw))
+    cg.add(var.set_register(config[CONF_REGISTER]))
+    cg.add(var.set_type(config[CONF_TYPE]))
+    cg.add(var.set_values(list(options.values())))
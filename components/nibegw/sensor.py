@@ -0,0 +1,123 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import sensor
+from esphome.const import (
+    CONF_UNIT_OF_MEASUREMENT,
+    STATE_CLASS_MEASUREMENT,
+    UNIT_BYTES,
+)
+from . import (
+    NibeGwComponent,
+    nibegw_ns,
+    REGISTER_TYPES,
+    CONF_REGISTER,
+    CONF_TYPE,
+    CONF_FACTOR,
+)
+
+NibeGwRegisterSensor = nibegw_ns.class_(
+    "NibeGwRegisterSensor", sensor.Sensor, cg.Component
+)
+NibeGwMetricSensor = nibegw_ns.class_(
+    "NibeGwMetricSensor", sensor.Sensor, cg.PollingComponent
+)
+MemoryMetric = nibegw_ns.enum("memory_metric_type")
+MemoryStructure = nibegw_ns.enum("memory_structure_type")
+
+CONF_GATEWAY = "gateway"
+CONF_PUBLISH_STALE = "publish_stale"
+CONF_METRIC = "metric"
+CONF_STRUCTURE = "structure"
+
+METRICS = {
+    "free_heap": MemoryMetric.MEMORY_METRIC_FREE_HEAP,
+    "min_free_heap": MemoryMetric.MEMORY_METRIC_MIN_FREE_HEAP,
+    "frame_min_free_heap": MemoryMetric.MEMORY_METRIC_FRAME_MIN_FREE_HEAP,
+    "tracked_bytes": MemoryMetric.MEMORY_METRIC_TRACKED_BYTES,
+    "tracked_bytes_max": MemoryMetric.MEMORY_METRIC_TRACKED_BYTES_MAX,
+    "count": MemoryMetric.MEMORY_METRIC_COUNT,
+    "count_max": MemoryMetric.MEMORY_METRIC_COUNT_MAX,
+}
+COUNT_METRICS = ("count", "count_max")
+
+STRUCTURES = {
+    "requests": MemoryStructure.MEMORY_REQUESTS,
+    "providers": MemoryStructure.MEMORY_PROVIDERS,
+    "listeners": MemoryStructure.MEMORY_LISTENERS,
+    "targets": MemoryStructure.MEMORY_TARGETS,
+    "pending_replies": MemoryStructure.MEMORY_PENDING_REPLIES,
+    "schedule": MemoryStructure.MEMORY_SCHEDULE,
+    "deferred_frames": MemoryStructure.MEMORY_DEFERRED_FRAMES,
+    "registers": MemoryStructure.MEMORY_REGISTERS,
+}
+
+REGISTER_SCHEMA = (
+    sensor.sensor_schema(NibeGwRegisterSensor)
+    .extend(
+        {
+            cv.GenerateID(CONF_GATEWAY): cv.use_id(NibeGwComponent),
+            cv.Required(CONF_REGISTER): cv.int_range(min=0, max=0xFFFE),
+            cv.Optional(CONF_TYPE, default="s16"): cv.enum(REGISTER_TYPES, lower=True),
+            cv.Optional(CONF_FACTOR, default=1.0): cv.float_,
+            cv.Optional(CONF_PUBLISH_STALE, default=True): cv.boolean,
+        }
+    )
+    .extend(cv.COMPONENT_SCHEMA)
+)
+
+
+def _validate_metric(config):
+    if (config[CONF_METRIC] in COUNT_METRICS) != (CONF_STRUCTURE in config):
+        raise cv.Invalid(
+            f"{CONF_STRUCTURE} is required for, and only allowed with, "
+            f"metric {' or '.join(COUNT_METRICS)}"
+        )
+    return config
+
+
+METRIC_SCHEMA = cv.All(
+    sensor.sensor_schema(
+        NibeGwMetricSensor,
+        accuracy_decimals=0,
+        state_class=STATE_CLASS_MEASUREMENT,
+    )
+    .extend(
+        {
+            cv.GenerateID(CONF_GATEWAY): cv.use_id(NibeGwComponent),
+            cv.Required(CONF_METRIC): cv.enum(METRICS, lower=True),
+            cv.Optional(CONF_STRUCTURE): cv.enum(STRUCTURES, lower=True),
+        }
+    )
+    .extend(cv.polling_component_schema("60s")),
+    _validate_metric,
+)
+
+
+def CONFIG_SCHEMA(config):
+    if isinstance(config, dict) and CONF_METRIC in config:
+        return METRIC_SCHEMA(config)
+    return REGISTER_SCHEMA(config)
+
+
+async def to_code(config):
+    var = await sensor.new_sensor(config)
+    await cg.register_component(var, config)
+    gw = await cg.get_variable(config[CONF_GATEWAY])
+    cg.add(var.set_gw(gw))
+    if CONF_METRIC in config:
+        cg.add(
+            var.set_metric(
+                config[CONF_METRIC],
+                config.get(CONF_STRUCTURE, STRUCTURES["requests"]),
+            )
+        )
+        if (
+            config[CONF_METRIC] not in COUNT_METRICS
+            and CONF_UNIT_OF_MEASUREMENT not in config
+        ):
+            cg.add(var.set_unit_of_measurement(UNIT_BYTES))
+        return
+    cg.add(var.set_register(config[CONF_REGISTER]))
+    cg.add(var.set_type(config[CONF_TYPE]))
+    cg.add(var.set_factor(config[CONF_FACTOR]))
+    cg.add(var.set_publish_stale(config[CONF_PUBLISH_STALE]))
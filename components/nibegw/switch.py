@@ -0,0 +1,53 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import switch
+from . import (
+    NibeGwComponent,
+    nibegw_ns,
+    REGISTER_TYPES,
+    CONF_REGISTER,
+    CONF_TYPE,
+)
+
+NibeGwSwitch = nibegw_ns.class_("NibeGwSwitch", switch.Switch, cg.Component)
+
+CONF_GATEWAY = "gateway"
+CONF_ON_VALUE = "on_value"
+CONF_OFF_VALUE = "off_value"
+
+
+def _validate_values(config):
+    if config[CONF_ON_VALUE] == config[CONF_OFF_VALUE]:
+        raise cv.Invalid(f"{CONF_ON_VALUE} and {CONF_OFF_VALUE} must differ")
+    return config
+
+
+CONFIG_SCHEMA = cv.All(
+    switch.switch_schema(NibeGwSwitch)
+    .extend(
+        {
+            cv.GenerateID(CONF_GATEWAY): cv.use_id(NibeGwComponent),
+            cv.Required(CONF_REGISTER): cv.int_range(min=0, max=0xFFFE),
+            cv.Optional(CONF_TYPE, default="u8"): cv.enum(REGISTER_TYPES, lower=True),
+            cv.Optional(CONF_ON_VALUE, default=1): cv.int_range(
+                min=-(2**31), max=2**31 - 1
+            ),
+            cv.Optional(CONF_OFF_VALUE, default=0): cv.int_range(
+                min=-(2**31), max=2**31 - 1
+            ),
+        }
+    )
+    .extend(cv.COMPONENT_SCHEMA),
+    _validate_values,
+)
+
+
+async def to_code(config):
+    var = await switch.new_switch(config)
+    await cg.register_component(var, config)
+    gw = await cg.get_variable(config[CONF_GATEWAY])
+    cg.add(var.set_gw(gw))
+    cg.add(var.set_register(config[CONF_REGISTER]))
+    cg.add(var.set_type(config[CONF_TYPE]))
+    cg.add(var.set_on_value(config[CONF_ON_VALUE]))
+    cg.add(var.set_off_value(config[CONF_OFF_VALUE]))
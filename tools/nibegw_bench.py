@@ -0,0 +1,373 @@
+#!/usr/bin/env python3
+"""Load generator and pump simulator for benchmarking a nibegw gateway.
+
+The pump command plays the MODBUS40 side of a heat pump on a pseudo
+terminal, which the gateway built from bench.yaml opens as its uart. It
+measures how long the gateway takes to answer the frames addressed to it.
+
+The load command drives the udp ports of the gateway with a number of
+clients at a fixed request rate each, and reports the share of requests
+answered by the pump, round trip times and the frames fanned out to each
+client. Several client counts can be given to run one step per count.
+"""
+
+import argparse
+import os
+import random
+import select
+import socket
+import statistics
+import sys
+import time
+import tty
+from functools import reduce
+from operator import xor
+
+MODBUS40 = 0x20
+MODBUS_DATA_MSG = 0x68
+READ_TOKEN = 0x69
+READ_RESP = 0x6A
+WRITE_TOKEN = 0x6B
+WRITE_RESP = 0x6C
+ACK = 0x06
+NAK = 0x15
+STATUS_REPLY_START = 0xFE
+
+REGISTER_BASE = 40000
+
+
+def checksum(data: bytes) -> int:
+    value = reduce(xor, data, 0)
+    return 0xC5 if value == 0x5C else value
+
+
+def slave_frame(command: int, data: bytes) -> bytes:
+    frame = bytes([0xC0, command, len(data)]) + data
+    return frame + bytes([checksum(frame)])
+
+
+def master_frame(address: int, command: int, data: bytes) -> bytes:
+    # The pump doubles 0x5C in the payload, the length counts the doubled bytes
+    data = data.replace(b"\x5c", b"\x5c\x5c")
+    frame = bytes([0x00, address, command, len(data)]) + data
+    return b"\x5c" + frame + bytes([checksum(frame)])
+
+
+def read_request(register: int) -> bytes:
+    return slave_frame(READ_TOKEN, register.to_bytes(2, "little"))
+
+
+def write_request(register: int, value: int) -> bytes:
+    return slave_frame(
+        WRITE_TOKEN,
+        register.to_bytes(2, "little") + value.to_bytes(4, "little", signed=True),
+    )
+
+
+def percentile(values, fraction):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * fraction))]
+
+
+class Pump:
+    """MODBUS40 side of a heat pump on the master end of a pseudo terminal."""
+
+    def __init__(self, args):
+        self.args = args
+        self.fd, slave = os.openpty()
+        tty.setraw(slave)
+        self.slave = slave
+        self.path = os.ttyname(slave)
+        if args.link:
+            if os.path.lexists(args.link):
+                os.unlink(args.link)
+            os.symlink(self.path, args.link)
+        self.buffer = bytearray()
+        self.reset()
+
+    def reset(self):
+        self.tokens = 0
+        self.missed = 0
+        self.naks = 0
+        self.reads = 0
+        self.writes = 0
+        self.response_ms = []
+
+    def send(self, frame: bytes) -> float:
+        os.write(self.fd, frame)
+        return time.monotonic()
+
+    def receive(self, count: int, deadline: float) -> bytes | None:
+        while len(self.buffer) < count:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                return None
+            ready, _, _ = select.select([self.fd], [], [], remaining)
+            if ready:
+                self.buffer += os.read(self.fd, 256)
+        data = bytes(self.buffer[:count])
+        del self.buffer[:count]
+        return data
+
+    def expect(self, sent: float) -> bytes | None:
+        """Wait for the answer to a frame, an ack, nak or a slave frame."""
+        deadline = sent + self.args.window / 1000
+        first = self.receive(1, deadline)
+        if first is None:
+            self.missed += 1
+            return None
+        self.response_ms.append((time.monotonic() - sent) * 1000)
+        if first[0] != 0xC0:
+            return first
+        header = self.receive(2, deadline + 0.1)
+        if header is None:
+            self.missed += 1
+            return None
+        rest = self.receive(header[1] + 1, deadline + 0.1)
+        if rest is None:
+            self.missed += 1
+            return None
+        return first + header + rest
+
+    def data_message(self):
+        data = b"".join(
+            (REGISTER_BASE + 4 + i).to_bytes(2, "little")
+            + random.randrange(0x10000).to_bytes(2, "little")
+            for i in range(20)
+        )
+        answer = self.expect(self.send(master_frame(MODBUS40, MODBUS_DATA_MSG, data)))
+        if answer and answer[0] == NAK:
+            self.naks += 1
+
+    def token(self, command: int):
+        self.tokens += 1
+        answer = self.expect(self.send(master_frame(MODBUS40, command, b"")))
+        if answer is None or len(answer) < 4:
+            return
+        if answer[-1] != checksum(answer[:-1]):
+            os.write(self.fd, bytes([NAK]))
+            self.naks += 1
+            return
+        os.write(self.fd, bytes([ACK]))
+        payload = answer[3:-1]
+        if answer[1] == READ_TOKEN and len(payload) == 2:
+            self.reads += 1
+            value = random.randrange(-(2**31), 2**31)
+            response = payload + value.to_bytes(4, "little", signed=True)
+            self.expect(self.send(master_frame(MODBUS40, READ_RESP, response)))
+        elif answer[1] == WRITE_TOKEN and len(payload) == 6:
+            self.writes += 1
+            self.expect(self.send(master_frame(MODBUS40, WRITE_RESP, b"\x01")))
+
+    def report(self):
+        responses = self.response_ms
+        print(
+            f"tokens {self.tokens} missed {self.missed} naks {self.naks} "
+            f"reads {self.reads} writes {self.writes} "
+            f"response avg {statistics.fmean(responses) if responses else 0:.2f} ms "
+            f"p99 {percentile(responses, 0.99):.2f} ms "
+            f"max {max(responses, default=0):.2f} ms",
+            flush=True,
+        )
+        self.reset()
+
+    def run(self):
+        print(f"Pump on {self.path}", flush=True)
+        last_report = time.monotonic()
+        commands = [MODBUS_DATA_MSG, READ_TOKEN, WRITE_TOKEN]
+        step = 0
+        while True:
+            command = commands[step % len(commands)]
+            step += 1
+            if command == MODBUS_DATA_MSG:
+                self.data_message()
+            else:
+                self.token(command)
+            time.sleep(self.args.interval / 1000)
+            if time.monotonic() - last_report >= self.args.report:
+                self.report()
+                last_report = time.monotonic()
+
+
+class Client:
+    def __init__(self, source: str, index: int):
+        self.index = index
+        self.socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.socket.bind((source, 0))
+        self.socket.setblocking(False)
+        self.frames = 0
+        self.sequence = 0
+
+    def next_register(self) -> int:
+        # Each client reads its own registers, so answers can be told apart
+        self.sequence = (self.sequence + 1) % 100
+        return REGISTER_BASE + 1000 + self.index * 100 + self.sequence
+
+
+class Load:
+    def __init__(self, args):
+        self.args = args
+
+    def step(self, count: int) -> dict:
+        args = self.args
+        clients = [Client(args.source, i) for i in range(count)]
+        spoofed = [Client(f"127.0.1.{i + 1}", count + i) for i in range(4)]
+        sockets = {c.socket.fileno(): c for c in clients + spoofed}
+
+        pending = {}
+        round_trips = []
+        statuses = {}
+        sent = invalid = spoofed_sent = 0
+        interval = 1 / args.rate
+        next_send = [time.monotonic() + random.random() * interval for _ in clients]
+        end = time.monotonic() + args.duration
+
+        while True:
+            now = time.monotonic()
+            if now >= end:
+                break
+            for i, client in enumerate(clients):
+                if now < next_send[i]:
+                    continue
+                next_send[i] += interval
+                sender = client
+                if random.random() < args.spoofed:
+                    sender = random.choice(spoofed)
+                    spoofed_sent += 1
+                register = client.next_register()
+                if random.random() < args.writes:
+                    frame = write_request(register, random.randrange(100))
+                    port = args.write_port
+                else:
+                    frame = read_request(register)
+                    port = args.read_port
+                    if sender is client:
+                        pending[register] = now
+                if random.random() < args.invalid:
+                    frame = frame[:-1] + bytes([frame[-1] ^ 0xFF])
+                    invalid += 1
+                    pending.pop(register, None)
+                sender.socket.sendto(frame, (args.host, port))
+                sent += 1
+
+            timeout = max(0.0, min(min(next_send), end) - time.monotonic())
+            ready, _, _ = select.select(list(sockets), [], [], timeout)
+            for fd in ready:
+                client = sockets[fd]
+                while True:
+                    try:
+                        data = client.socket.recv(512)
+                    except BlockingIOError:
+                        break
+                    self.receive(client, data, pending, round_trips, statuses)
+
+        for client in clients + spoofed:
+            client.socket.close()
+
+        valid = sent - invalid - spoofed_sent
+        return {
+            "clients": count,
+            "sent": sent,
+            "invalid": invalid,
+            "spoofed": spoofed_sent,
+            "answered": len(round_trips),
+            "answered_pct": 100 * len(round_trips) / valid if valid else 0,
+            "rtt_avg": statistics.fmean(round_trips) if round_trips else 0,
+            "rtt_p95": percentile(round_trips, 0.95),
+            "rtt_max": max(round_trips, default=0),
+            "frames": sum(c.frames for c in clients) / count / args.duration,
+            "statuses": statuses,
+        }
+
+    @staticmethod
+    def receive(client, data, pending, round_trips, statuses):
+        if data[0] == STATUS_REPLY_START:
+            # Counted as type/status, 2/1 are requests refused by a full queue
+            if len(data) >= 3:
+                key = f"{data[1]}/{data[2]}"
+                statuses[key] = statuses.get(key, 0) + 1
+            return
+        if data[0] != 0x5C:
+            return
+        client.frames += 1
+        if len(data) >= 8 and data[3] == READ_RESP:
+            payload = data[5:-1].replace(b"\x5c\x5c", b"\x5c")
+            register = int.from_bytes(payload[0:2], "little")
+            if (started := pending.pop(register, None)) is not None:
+                round_trips.append((time.monotonic() - started) * 1000)
+
+    def run(self):
+        print(
+            f"{'clients':>7} {'sent':>7} {'answered':>9} {'rtt avg':>8} "
+            f"{'rtt p95':>8} {'rtt max':>8} {'frames/s':>9}  statuses",
+            flush=True,
+        )
+        for count in self.args.clients:
+            result = self.step(count)
+            statuses = " ".join(
+                f"{status}:{n}" for status, n in sorted(result["statuses"].items())
+            )
+            print(
+                f"{result['clients']:>7} {result['sent']:>7} "
+                f"{result['answered_pct']:>8.1f}% {result['rtt_avg']:>6.1f}ms "
+                f"{result['rtt_p95']:>6.1f}ms {result['rtt_max']:>6.1f}ms "
+                f"{result['frames']:>9.1f}  {statuses}",
+                flush=True,
+            )
+            time.sleep(self.args.pause)
+
+
+def counts(value: str) -> list[int]:
+    return [int(item) for item in value.split(",")]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    pump = commands.add_parser("pump", help="simulate a heat pump on a pty")
+    pump.add_argument("--link", default="/tmp/nibegw-pump", help="symlink to the pty")
+    pump.add_argument(
+        "--interval", type=float, default=50, help="ms between frames from the pump"
+    )
+    pump.add_argument(
+        "--window", type=float, default=20, help="ms the gateway has to answer"
+    )
+    pump.add_argument("--report", type=float, default=10, help="s between reports")
+
+    load = commands.add_parser("load", help="drive the udp ports of a gateway")
+    load.add_argument("--host", default="127.0.0.1")
+    load.add_argument("--source", default="127.0.0.1", help="address of clients")
+    load.add_argument("--read-port", type=int, default=9999)
+    load.add_argument("--write-port", type=int, default=10000)
+    load.add_argument(
+        "--clients", type=counts, default=[1], help="client counts, one step each"
+    )
+    load.add_argument("--rate", type=float, default=1, help="requests/s per client")
+    load.add_argument("--duration", type=float, default=30, help="s per step")
+    load.add_argument("--pause", type=float, default=5, help="s between steps")
+    load.add_argument("--writes", type=float, default=0, help="share of writes")
+    load.add_argument(
+        "--invalid", type=float, default=0, help="share with a broken checksum"
+    )
+    load.add_argument(
+        "--spoofed",
+        type=float,
+        default=0,
+        help="share sent from 127.0.1.x, outside the allowed sources",
+    )
+
+    args = parser.parse_args()
+    try:
+        if args.command == "pump":
+            Pump(args).run()
+        else:
+            Load(args).run()
+    except KeyboardInterrupt:
+        sys.exit(0)
+
+
+if __name__ == "__main__":
+    main()
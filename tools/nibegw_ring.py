@@ -0,0 +1,204 @@
+#!/usr/bin/env python3
+"""Reader for the shared memory ring of a nibegw gateway on the host platform.
+
+Attaches to the ring file given by shared_ring in the gateway config, claims
+one of its reader cursors and prints the frames and register updates as the
+gateway writes them. Records are parsed in place in the mapping, without a
+system call per record, and checked against the slot lock afterwards. Any
+number of readers can run in parallel, up to the readers of the config.
+"""
+
+import argparse
+import fcntl
+import mmap
+import os
+import struct
+import sys
+import time
+
+MAGIC = 0x5247574E
+VERSION = 1
+HEADER = struct.Struct("=IHHII")
+HEAD_OFFSET = 16
+GENERATION_OFFSET = 24
+HEADER_SIZE = 64
+CURSOR_SIZE = 64
+CURSOR_OWNER = 0
+CURSOR_POSITION = 8
+CURSOR_LOST = 16
+SLOT = struct.Struct("=IHBBQI")
+SLOT_DATA = 24
+
+FRAME = 1
+REGISTER = 2
+
+U32 = struct.Struct("=I")
+U64 = struct.Struct("=Q")
+REGISTER_DATA = struct.Struct("=HI")
+
+
+class Ring:
+    def __init__(self, path: str):
+        self.path = path
+        self.lost = 0
+        self.current = (0, 0)
+        self.attach()
+        self.position = self.head()
+        self.store(CURSOR_POSITION, U64, self.position)
+
+    def attach(self):
+        """Map the file at path, waiting until the gateway has set it up."""
+        while True:
+            self.fd = os.open(self.path, os.O_RDWR)
+            if os.fstat(self.fd).st_size >= HEADER_SIZE:
+                self.map = mmap.mmap(self.fd, 0)
+                if self.valid():
+                    break
+                self.map.close()
+            os.close(self.fd)
+            time.sleep(0.1)
+        _, version, self.slot_size, self.slot_count, self.readers = HEADER.unpack_from(
+            self.map, 0
+        )
+        if version != VERSION:
+            sys.exit(f"Unsupported ring version {version}")
+        self.slots = HEADER_SIZE + self.readers * CURSOR_SIZE
+        self.generation = self.load_generation()
+        self.cursor = self.claim()
+        self.store(CURSOR_OWNER, U32, os.getpid())
+        self.store(CURSOR_LOST, U64, self.lost)
+
+    def valid(self) -> bool:
+        return U32.unpack_from(self.map, 0)[0] == MAGIC
+
+    def replaced(self) -> bool:
+        """The gateway put a file of another size in place of ours."""
+        try:
+            return os.stat(self.path).st_ino != os.fstat(self.fd).st_ino
+        except FileNotFoundError:
+            return False
+
+    def load_generation(self) -> int:
+        return U32.unpack_from(self.map, GENERATION_OFFSET)[0]
+
+    def claim(self) -> int:
+        """Lock a free cursor, the lock goes away with the process."""
+        for index in range(self.readers):
+            offset = HEADER_SIZE + index * CURSOR_SIZE
+            try:
+                fcntl.lockf(self.fd, fcntl.LOCK_EX | fcntl.LOCK_NB, CURSOR_SIZE, offset)
+            except OSError:
+                continue
+            return offset
+        sys.exit(f"All {self.readers} reader cursors are taken")
+
+    def store(self, field: int, kind: struct.Struct, value: int):
+        kind.pack_into(self.map, self.cursor + field, value)
+
+    def head(self) -> int:
+        return U64.unpack_from(self.map, HEAD_OFFSET)[0]
+
+    def consistent(self) -> bool:
+        offset, lock = self.current
+        return U32.unpack_from(self.map, offset)[0] == lock
+
+    def records(self):
+        """Yield (kind, bus, time, data) with data a memoryview into the mapping.
+
+        The writer may reuse the slot at any time, so anything taken from
+        a record is only good when consistent() holds afterwards.
+        """
+        view = memoryview(self.map)
+        while True:
+            if not self.valid():
+                if self.replaced():
+                    # A new file with another layout, start over at its head.
+                    # The old mapping goes away with the last record view
+                    os.close(self.fd)
+                    self.attach()
+                    self.position = self.head()
+                    view = memoryview(self.map)
+                else:
+                    # Being reset in place
+                    time.sleep(0.01)
+                continue
+            generation = self.load_generation()
+            if generation != self.generation:
+                # The gateway restarted. It resumes after its last record,
+                # unless it reset the ring, which zeroed our cursor
+                self.generation = generation
+                self.store(CURSOR_OWNER, U32, os.getpid())
+                self.store(CURSOR_LOST, U64, self.lost)
+            head = self.head()
+            if head < self.position:
+                self.position = 0
+            if head - self.position > self.slot_count:
+                self.lost += head - self.position - self.slot_count
+                self.position = head - self.slot_count
+                self.store(CURSOR_LOST, U64, self.lost)
+            if self.position == head:
+                time.sleep(0.001)
+                continue
+
+            offset = self.slots + (self.position % self.slot_count) * self.slot_size
+            lock, length, kind, bus, seq, stamp = SLOT.unpack_from(self.map, offset)
+            if lock & 1 or seq != self.position:
+                # Being written, or already reused for a newer record
+                continue
+            data = view[offset + SLOT_DATA : offset + SLOT_DATA + length]
+            self.current = (offset, lock)
+            yield kind, bus, stamp, data
+            if not self.consistent():
+                self.lost += 1
+                self.store(CURSOR_LOST, U64, self.lost)
+            self.position += 1
+            self.store(CURSOR_POSITION, U64, self.position)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("path", nargs="?", default="/dev/shm/nibegw")
+    parser.add_argument("--kind", choices=["all", "frames", "registers"], default="all")
+    parser.add_argument(
+        "--stats", type=float, default=0, help="s between rate reports, no records"
+    )
+    args = parser.parse_args()
+
+    ring = Ring(args.path)
+    print(
+        f"Reading {args.path}: {ring.slot_count} slots, "
+        f"cursor {(ring.cursor - HEADER_SIZE) // CURSOR_SIZE}",
+        file=sys.stderr,
+        flush=True,
+    )
+
+    counts = {FRAME: 0, REGISTER: 0}
+    last_report = time.monotonic()
+    try:
+        for kind, bus, stamp, data in ring.records():
+            counts[kind] = counts.get(kind, 0) + 1
+            if args.stats:
+                now = time.monotonic()
+                if now - last_report >= args.stats:
+                    elapsed = now - last_report
+                    print(
+                        f"frames {counts[FRAME] / elapsed:.1f}/s "
+                        f"registers {counts[REGISTER] / elapsed:.1f}/s lost {ring.lost}",
+                        flush=True,
+                    )
+                    counts = {FRAME: 0, REGISTER: 0}
+                    last_report = now
+            elif kind == FRAME and args.kind in ("all", "frames"):
+                line = f"{stamp:10} bus {bus} frame {data.hex(' ')}"
+                if ring.consistent():
+                    print(line, flush=True)
+            elif kind == REGISTER and args.kind in ("all", "registers"):
+                address, value = REGISTER_DATA.unpack_from(data)
+                if ring.consistent():
+                    print(f"{stamp:10} register {address} = {value}", flush=True)
+    except KeyboardInterrupt:
+        sys.exit(0)
+
+
+if __name__ == "__main__":
+    main()